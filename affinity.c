@@ -0,0 +1,65 @@
+#define _GNU_SOURCE                   // for sched_setaffinity and the CPU_* macros
+#include <sched.h>
+#include <stdlib.h>  /* for malloc/free */
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "lib.h"
+#include "affinity.h"
+
+
+#ifdef __linux__
+int bindThreads(void){
+    cpu_set_t allowed, core;
+    int *cpus, count = 0, cpu, share, sharers, threads = 1, failed = 0, any_failed, per_core, most;
+    uint64_t set_hash = 0;
+    MPI_Comm node, same_set;
+
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) CPU_ZERO(&allowed);
+    cpus = malloc(sizeof(int) * CPU_SETSIZE);
+    for (cpu = 0; cpu < CPU_SETSIZE; cpu++){
+        if (CPU_ISSET(cpu, &allowed)){
+            cpus[count++] = cpu;
+            set_hash = mixHash(set_hash ^ (uint64_t) cpu);
+        }
+    }
+
+    // the processes of this node that may run on the same cores take their turns in them
+    MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, 0, MPI_INFO_NULL, &node);
+    MPI_Comm_split(node, (int) (set_hash & 0x7FFFFFFF), 0, &same_set);
+    MPI_Comm_rank(same_set, &share);
+    MPI_Comm_size(same_set, &sharers);
+
+#ifdef _OPENMP
+    threads = omp_get_max_threads();
+#endif
+
+#pragma omp parallel private(core, cpu) reduction(|:failed)
+    {
+        cpu = 0;
+#ifdef _OPENMP
+        cpu = omp_get_thread_num();
+#endif
+        cpu = (share * threads + cpu) % (count > 0 ? count : 1);
+
+        CPU_ZERO(&core);
+        CPU_SET(count > 0 ? cpus[cpu] : 0, &core);
+        failed |= count == 0 || sched_setaffinity(0, sizeof(core), &core) != 0;      // 0 is the calling thread
+    }
+
+    per_core = (count > 0) ? (sharers * threads + count - 1) / count : 0;
+    MPI_Allreduce(&failed, &any_failed, 1, MPI_INT, MPI_LOR, MPI_COMM_WORLD);
+    MPI_Allreduce(&per_core, &most, 1, MPI_INT, MPI_MAX, MPI_COMM_WORLD);
+
+    MPI_Comm_free(&same_set);
+    MPI_Comm_free(&node);
+    free(cpus);
+    return any_failed ? 0 : most;
+}
+#else
+int bindThreads(void){
+    return 0;
+}
+#endif
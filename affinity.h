@@ -0,0 +1,14 @@
+#ifndef _AFFINITY_H_
+#define _AFFINITY_H_
+
+#include "lib.h"
+
+
+// Collective. Bind every OpenMP thread of every process to one core of those the process may run on, so that the
+// threads, and the pages they first touch, stay on their NUMA node. Processes of a node that were given the same
+// cores (or none in particular) share them out in rank order. Returns the most threads bound to the same core, 1 unless
+// there are more threads than cores, or 0 when the threads could not be bound.
+int bindThreads(void);
+
+
+#endif
@@ -0,0 +1,184 @@
+#include <stdlib.h>  /* for malloc/free */
+#include <string.h>
+
+#include "lib.h"
+#include "balance.h"
+#include "pages.h"
+
+
+// New cuts start[1..parts-1] of n cells in parts blocks, from the old ones and the work measured on every block:
+// each block gets the same share of the work, taken as spread evenly over the cells of the old blocks, and at least
+// `least` cells.
+static void draw_cuts(int *start, const double *work, int parts, int least){
+    int *old = malloc(sizeof(int) * (parts + 1));
+    double total = 0, before = 0, target;
+    int i, k, n = start[parts];
+
+    memcpy(old, start, sizeof(int) * (parts + 1));
+    for (i = 0; i < parts; i++) total += work[i];
+
+    if (total > 0){
+        for (i = 0, k = 1; k < parts; k++){
+            target = total * k / parts;
+            while (i < parts - 1 && before + work[i] < target) before += work[i++];
+
+            start[k] = old[i] + (int) ((target - before) / work[i] * (old[i+1] - old[i]) + 0.5);
+            if (start[k] > old[i+1]) start[k] = old[i+1];
+        }
+    }
+
+    // n holds parts blocks of least cells, setupGrid made sure of it
+    for (k = 1; k < parts; k++)     if (start[k] < start[k-1] + least) start[k] = start[k-1] + least;
+    for (k = parts - 1; k > 0; k--) if (start[k] > start[k+1] - least) start[k] = start[k+1] - least;
+    start[parts] = n;
+    free(old);
+}
+
+
+// [*from, *to) is where [a0, a1) and [b0, b1) overlap, returns its length
+static int overlap(int a0, int a1, int b0, int b1, int *from, int *to){
+    *from = (a0 > b0) ? a0 : b0;
+    *to   = (a1 < b1) ? a1 : b1;
+    return (*to > *from) ? *to - *from : 0;
+}
+
+// the rows x cols part of a block at (row, col) of it, or nothing
+static MPI_Datatype part_type(int block_rows, int block_cols, int row, int col, int rows, int cols){
+    int sizes[2] = {block_rows, block_cols}, subsizes[2] = {rows, cols}, starts[2] = {row, col};
+    MPI_Datatype type;
+
+    if (rows == 0 || cols == 0) return MPI_INT;
+    MPI_Type_create_subarray(2, sizes, subsizes, starts, MPI_ORDER_C, MPI_INT, &type);
+    MPI_Type_commit(&type);
+    return type;
+}
+
+
+// Every process sends each new owner the part of its old block that falls in the new block, and receives the parts
+// of its new block from their old owners, all in one MPI_Alltoallw
+static int *move_cells(int *board, const int *row_start, const int *col_start){
+    int numprocs, q, coords[2], r0, r1, c0, c1, rows, cols;
+    int new_rows = row_start[Grid.coords[0] + 1] - row_start[Grid.coords[0]];
+    int new_cols = col_start[Grid.coords[1] + 1] - col_start[Grid.coords[1]];
+    int new_row0 = row_start[Grid.coords[0]], new_col0 = col_start[Grid.coords[1]];
+    int *counts[2], *displs;
+    MPI_Datatype *types[2];
+    int *moved = allocateBoard(sizeof(int) * (size_t) new_rows * new_cols);
+
+    MPI_Comm_size(Grid.comm, &numprocs);
+    counts[0] = malloc(sizeof(int) * numprocs);
+    counts[1] = malloc(sizeof(int) * numprocs);
+    displs    = calloc(numprocs, sizeof(int));
+    types[0]  = malloc(sizeof(MPI_Datatype) * numprocs);
+    types[1]  = malloc(sizeof(MPI_Datatype) * numprocs);
+
+    for (q = 0; q < numprocs; q++){
+        MPI_Cart_coords(Grid.comm, q, 2, coords);
+
+        // what it gets from the old block
+        rows = overlap(Grid.row0, Grid.row0 + Grid.rows, row_start[coords[0]], row_start[coords[0] + 1], &r0, &r1);
+        cols = overlap(Grid.col0, Grid.col0 + Grid.cols, col_start[coords[1]], col_start[coords[1] + 1], &c0, &c1);
+        types[0][q]  = part_type(Grid.rows, Grid.cols, r0 - Grid.row0, c0 - Grid.col0, rows, cols);
+        counts[0][q] = (rows > 0 && cols > 0);
+
+        // what the new block gets from its old one
+        rows = overlap(new_row0, new_row0 + new_rows, blockRow0(coords[0]), blockRow0(coords[0]) + blockRows(coords[0]), &r0, &r1);
+        cols = overlap(new_col0, new_col0 + new_cols, blockCol0(coords[1]), blockCol0(coords[1]) + blockCols(coords[1]), &c0, &c1);
+        types[1][q]  = part_type(new_rows, new_cols, r0 - new_row0, c0 - new_col0, rows, cols);
+        counts[1][q] = (rows > 0 && cols > 0);
+    }
+
+    MPI_Alltoallw(board, counts[0], displs, types[0], moved, counts[1], displs, types[1], Grid.comm);
+
+    for (q = 0; q < numprocs; q++){
+        if (counts[0][q]) MPI_Type_free(&types[0][q]);
+        if (counts[1][q]) MPI_Type_free(&types[1][q]);
+    }
+    free(counts[0]);
+    free(counts[1]);
+    free(displs);
+    free(types[0]);
+    free(types[1]);
+
+    freeBoard(board, sizeof(int) * (size_t) Grid.rows * Grid.cols);
+    return moved;
+}
+
+
+// the cuts drawn by the last rebalanceCuts that moved them, until moveBlocks
+static int *next_row_start = NULL, *next_col_start = NULL;
+
+int rebalanceCuts(double load){
+    int myid, numprocs, q, coords[2], moved = 0, least_rows, least_cols;
+    double *loads, *row_work, *col_work, busiest = 0, mean = 0;
+    int *row_start = malloc(sizeof(int) * (Grid.dims[0] + 1));
+    int *col_start = malloc(sizeof(int) * (Grid.dims[1] + 1));
+
+    MPI_Comm_rank(Grid.comm, &myid);
+    MPI_Comm_size(Grid.comm, &numprocs);
+
+    loads = malloc(sizeof(double) * numprocs);
+    MPI_Allgather(&load, 1, MPI_DOUBLE, loads, 1, MPI_DOUBLE, Grid.comm);
+
+    memcpy(row_start, Grid.row_start, sizeof(int) * (Grid.dims[0] + 1));
+    memcpy(col_start, Grid.col_start, sizeof(int) * (Grid.dims[1] + 1));
+
+    // the master draws the cuts, so that the processes cannot disagree by a rounding
+    if (I_AM_MASTER(myid)){
+        row_work = calloc(Grid.dims[0], sizeof(double));
+        col_work = calloc(Grid.dims[1], sizeof(double));
+        for (q = 0; q < numprocs; q++){
+            MPI_Cart_coords(Grid.comm, q, 2, coords);
+            row_work[coords[0]] += loads[q];
+            col_work[coords[1]] += loads[q];
+            if (loads[q] > busiest) busiest = loads[q];
+            mean += loads[q] / numprocs;
+        }
+
+        if (mean > 0 && busiest > mean * (1 + Params.imbalance / 100.0)){
+            // the same limits as setupGrid: a halo from the next block only, and whole bytes for the files
+            least_rows = Params.halo_depth;
+            least_cols = Params.halo_depth;
+            if ((Params.checkpoint_every > 0 || Params.snapshot_every > 0) && Grid.dims[1] > 1 && least_cols < 8) least_cols = 8;
+
+            draw_cuts(row_start, row_work, Grid.dims[0], least_rows);
+            draw_cuts(col_start, col_work, Grid.dims[1], least_cols);
+            moved = memcmp(row_start, Grid.row_start, sizeof(int) * (Grid.dims[0] + 1)) != 0
+                 || memcmp(col_start, Grid.col_start, sizeof(int) * (Grid.dims[1] + 1)) != 0;
+            if (moved) printf("Moved the blocks, the busiest process computed %.0f%% longer than the mean.\n", 100 * (busiest / mean - 1));
+        }
+        free(row_work);
+        free(col_work);
+    }
+
+    MPI_Bcast(&moved, 1, MPI_INT, MASTER_PROC_ID, Grid.comm);
+    if (moved){
+        MPI_Bcast(row_start, Grid.dims[0] + 1, MPI_INT, MASTER_PROC_ID, Grid.comm);
+        MPI_Bcast(col_start, Grid.dims[1] + 1, MPI_INT, MASTER_PROC_ID, Grid.comm);
+        next_row_start = row_start;
+        next_col_start = col_start;
+    }else{
+        free(row_start);
+        free(col_start);
+    }
+
+    free(loads);
+    return moved;
+}
+
+
+void moveBlocks(int **board){
+    *board = move_cells(*board, next_row_start, next_col_start);
+
+    memcpy(Grid.row_start, next_row_start, sizeof(int) * (Grid.dims[0] + 1));
+    memcpy(Grid.col_start, next_col_start, sizeof(int) * (Grid.dims[1] + 1));
+    Grid.rows = blockRows(Grid.coords[0]);
+    Grid.cols = blockCols(Grid.coords[1]);
+    Grid.row0 = blockRow0(Grid.coords[0]);
+    Grid.col0 = blockCol0(Grid.coords[1]);
+
+    free(next_row_start);
+    free(next_col_start);
+    next_row_start = NULL;
+    next_col_start = NULL;
+}
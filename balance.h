@@ -0,0 +1,22 @@
+#ifndef _BALANCE_H_
+#define _BALANCE_H_
+
+#include "lib.h"
+
+
+// Dynamic load balancing (--balance). The process grid keeps its shape and its neighbours, only the cuts between
+// its rows and columns move: every process row gets the same share of the time the processes spent computing, and
+// so does every process column, the work of a block being taken as spread evenly over its cells. The kernels that
+// skip the quiet parts of the board (tiled) are the ones that drift apart, the others only as the nodes do.
+//
+// Collective. load is the time this process spent computing since the last call. When the busiest process took more
+// than Params.imbalance % longer than the mean, the cuts are drawn again. Returns whether they moved: only then does
+// the board have to be handed to moveBlocks, so a game whose blocks stay put keeps its board as it is.
+int rebalanceCuts(double load);
+
+// Collective, after rebalanceCuts moved the cuts. The cells of *board (a Grid.rows x Grid.cols block of ints) are
+// sent to their new owners into a new block, and Grid describes the new blocks.
+void moveBlocks(int **board);
+
+
+#endif
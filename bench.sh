@@ -0,0 +1,85 @@
+#!/bin/sh
+# Scaling sweeps of the game over kernels, board sizes, processes and threads (make bench).
+# Every setting can be changed from the environment, e.g.
+#   SIZES="4096 8192" PROCS="1 4 16" THREADS=1 KERNELS="packed simd" SCALING=weak ./bench.sh
+#
+# Writes OUT.raw.csv with the report of every run (see game --report), then OUT.csv and OUT.json with the mean
+# of the repeats of each setting and its parallel efficiency against the setting with the fewest cores: with strong
+# scaling the same board is played on more cores, with weak scaling its columns grow with the cores.
+
+SIZES=${SIZES:-"1024 2048"}
+PROCS=${PROCS:-"1 2 4"}
+THREADS=${THREADS:-"1 2"}
+KERNELS=${KERNELS:-"int packed simd tiled flat"}
+GENERATIONS=${GENERATIONS:-100}
+WARMUP=${WARMUP:-10}
+REPEATS=${REPEATS:-3}
+SCALING=${SCALING:-strong}
+MPIRUN=${MPIRUN:-mpirun}
+OUT=${OUT:-bench}
+
+RAW=$OUT.raw.csv
+rm -f "$RAW"
+
+for kernel in $KERNELS; do
+    for size in $SIZES; do
+        for procs in $PROCS; do
+            # the flat kernel plays the whole board on a single process
+            if [ "$kernel" = flat ] && [ "$procs" -gt 1 ]; then continue; fi
+
+            for threads in $THREADS; do
+                cols=$size
+                if [ "$SCALING" = weak ]; then cols=$((size * procs * threads)); fi
+                echo "$kernel: $size x $cols on $procs processes of $threads threads" >&2
+
+                repeat=0
+                while [ $repeat -lt "$REPEATS" ]; do
+                    $MPIRUN -np "$procs" ./game -r "$size" -c "$cols" -k "$kernel" -t "$threads" -S 1 \
+                        -e $((GENERATIONS + WARMUP)) -w "$WARMUP" -j "$RAW" > /dev/null || exit 1
+                    repeat=$((repeat + 1))
+                done
+            done
+        done
+    done
+done
+
+# columns of the raw report: kernel rows cols procs grid threads halo_depth generations seconds cells_per_second,
+# then the max and mean over the processes of the inner, halo, border, reduce and other phases
+awk -F, -v scaling="$SCALING" -v csv="$OUT.csv" -v json="$OUT.json" '
+NR == 1 { next }
+{
+    key = $1 "," $2 "," $4 "," $6
+    if (!(key in runs)) { order[++settings] = key; kernel[key] = $1; size[key] = $2; cols[key] = $3; procs[key] = $4; threads[key] = $6 }
+    runs[key]++
+    seconds[key] += $9;  squares[key] += $9 * $9
+    rate[key]    += $10
+    for (p = 0; p < 5; p++) phase[key, p] += $(11 + 2 * p)
+
+    # the baseline of a kernel and size is its setting with the fewest cores
+    base = $1 "," $2
+    if (!(base in fewest) || $4 * $6 < fewest[base]) { fewest[base] = $4 * $6; baseline[base] = key }
+}
+END {
+    print "kernel,rows,cols,procs,threads,runs,seconds,seconds_stddev,cells_per_second,inner,halo,border,reduce,other,efficiency" > csv
+    print "[" > json
+    for (i = 1; i <= settings; i++) {
+        k = order[i]; b = baseline[kernel[k] "," size[k]]
+        mean = seconds[k] / runs[k]; base_mean = seconds[b] / runs[b]
+        stddev = squares[k] / runs[k] - mean * mean; stddev = stddev > 0 ? sqrt(stddev) : 0
+        cores = procs[k] * threads[k]; base_cores = procs[b] * threads[b]
+        if (scaling == "weak") efficiency = mean > 0 ? base_mean / mean : 0
+        else                   efficiency = mean > 0 ? (base_mean * base_cores) / (mean * cores) : 0
+
+        printf "%s,%d,%d,%d,%d,%d,%.6f,%.6f,%.6e", kernel[k], size[k], cols[k], procs[k], threads[k], runs[k], mean, stddev, rate[k] / runs[k] > csv
+        for (p = 0; p < 5; p++) printf ",%.6f", phase[k, p] / runs[k] > csv
+        printf ",%.3f\n", efficiency > csv
+
+        printf "  {\"kernel\": \"%s\", \"rows\": %d, \"cols\": %d, \"procs\": %d, \"threads\": %d, \"runs\": %d, \"seconds\": %.6f, \"seconds_stddev\": %.6f, \"cells_per_second\": %.6e, ", \
+               kernel[k], size[k], cols[k], procs[k], threads[k], runs[k], mean, stddev, rate[k] / runs[k] > json
+        printf "\"inner\": %.6f, \"halo\": %.6f, \"border\": %.6f, \"reduce\": %.6f, \"other\": %.6f, \"efficiency\": %.3f}%s\n", \
+               phase[k, 0] / runs[k], phase[k, 1] / runs[k], phase[k, 2] / runs[k], phase[k, 3] / runs[k], phase[k, 4] / runs[k], efficiency, i < settings ? "," : "" > json
+    }
+    print "]" > json
+}' "$RAW"
+
+echo "Wrote $OUT.csv and $OUT.json." >&2
@@ -0,0 +1,127 @@
+#include <stdlib.h>  /* for malloc/free */
+#include <string.h>
+
+#include "lib.h"
+#include "checkpoint.h"
+
+static long long first_generation = 0;
+
+
+static MPI_Offset row_bytes(void){
+    return (Params.Cols + 7) / 8;
+}
+
+// The subarray of bytes [row0, row0+rows) x [byte0, byte1) of the board in the file
+static void set_board_view(MPI_File file, int byte0, int byte1){
+    MPI_Datatype view;
+    int sizes[2]    = {Params.Rows, (int) row_bytes()};
+    int subsizes[2] = {Grid.rows, byte1 - byte0};
+    int starts[2]   = {Grid.row0, byte0};
+
+    MPI_Type_create_subarray(2, sizes, subsizes, starts, MPI_ORDER_C, MPI_BYTE, &view);
+    MPI_Type_commit(&view);
+    MPI_File_set_view(file, sizeof(struct checkpointHeader), MPI_BYTE, view, "native", MPI_INFO_NULL);
+    MPI_Type_free(&view);
+}
+
+
+long long readCheckpointHeader(const char *path){
+    struct checkpointHeader header;
+    MPI_File file;
+    int ok, myid;
+
+    MPI_Comm_rank(MPI_COMM_WORLD, &myid);
+    if (MPI_File_open(MPI_COMM_WORLD, (char *) path, MPI_MODE_RDONLY, MPI_INFO_NULL, &file) != MPI_SUCCESS){
+        collectiveError("Could not open the checkpoint `%s'.\n", path);
+    }
+
+    if (I_AM_MASTER(myid)) MPI_File_read_at(file, 0, &header, sizeof(header), MPI_BYTE, MPI_STATUS_IGNORE);
+    MPI_Bcast(&header, sizeof(header), MPI_BYTE, MASTER_PROC_ID, MPI_COMM_WORLD);
+    MPI_File_close(&file);
+
+    ok = memcmp(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic)) == 0 && header.rows > 0 && header.cols > 0;
+    if (!ok) collectiveError("`%s' is not a checkpoint.\n", path);
+
+    Params.Rows = (int) header.rows;
+    Params.Cols = (int) header.cols;
+    // the seed of the board goes on with it, so that the restart draws nothing from the clock
+    if (!Params.seed_given) Params.seed = header.seed;
+    Params.seed_given = 1;
+
+    // checkpoints keep playing their own rule, unless told otherwise
+    header.rule[sizeof(header.rule) - 1] = '\0';
+    if (!Params.rule_given && !parseRule(header.rule, &Rule)) collectiveError("The rule of the checkpoint `%s' is unknown.\n", path);
+    return header.generation;
+}
+
+
+void readCheckpoint(const char *path, int *block){
+    int byte0 = Grid.col0 / 8, byte1 = (Grid.col0 + Grid.cols - 1) / 8 + 1, width = byte1 - byte0;
+    int row, col, shift = Grid.col0 - 8 * byte0;
+    unsigned char *bytes = malloc((size_t) Grid.rows * width);
+    MPI_File file;
+
+    // the bytes at both ends may be shared with the neighbours, reading them twice is fine
+    MPI_File_open(Grid.comm, (char *) path, MPI_MODE_RDONLY, MPI_INFO_NULL, &file);
+    set_board_view(file, byte0, byte1);
+    MPI_File_read_at_all(file, 0, bytes, Grid.rows * width, MPI_BYTE, MPI_STATUS_IGNORE);
+    MPI_File_close(&file);
+
+    for (row = 0; row < Grid.rows; row++){
+        for (col = 0; col < Grid.cols; col++){
+            block[row * Grid.cols + col] = (bytes[(size_t) row * width + (shift + col) / 8] >> ((shift + col) % 8)) & 1;
+        }
+    }
+    free(bytes);
+}
+
+
+void setupCheckpoints(long long generation){
+    first_generation = generation;
+}
+
+int checkpointDue(int numIterations){
+    return Params.checkpoint_every > 0 && numIterations % Params.checkpoint_every == 0;
+}
+
+
+// the bytes that start in a block are written by its process
+void writeCheckpoint(struct subboard block, int numIterations){
+    int byte0, width, myid;
+    unsigned char *bytes = packBlockBytes(block, 0, &byte0, &width);
+    char *temp_path = malloc(strlen(Params.checkpoint_file) + 5);
+    struct checkpointHeader header;
+    MPI_File file;
+
+    // written next to the previous checkpoint, which is only replaced by a complete one
+    sprintf(temp_path, "%s.tmp", Params.checkpoint_file);
+    MPI_Comm_rank(Grid.comm, &myid);
+    if (MPI_File_open(Grid.comm, temp_path, MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &file) != MPI_SUCCESS){
+        collectiveError("Could not write the checkpoint `%s'.\n", temp_path);
+    }
+    MPI_File_set_size(file, (MPI_Offset) sizeof(header) + (MPI_Offset) Params.Rows * row_bytes());
+
+    if (I_AM_MASTER(myid)){
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic));
+        header.rows       = Params.Rows;
+        header.cols       = Params.Cols;
+        header.generation = first_generation + numIterations;
+        header.seed       = Params.seed;
+        strcpy(header.rule, Rule.name);
+        MPI_File_write_at(file, 0, &header, sizeof(header), MPI_BYTE, MPI_STATUS_IGNORE);
+    }
+
+    set_board_view(file, byte0, byte0 + width);
+    MPI_File_write_at_all(file, 0, bytes, Grid.rows * width, MPI_BYTE, MPI_STATUS_IGNORE);
+    MPI_File_close(&file);
+
+    MPI_Barrier(Grid.comm);
+    if (I_AM_MASTER(myid) && rename(temp_path, Params.checkpoint_file) != 0){
+        fprintf(stderr, "Could not replace the checkpoint `%s'.\n", Params.checkpoint_file);
+    }
+    MPI_Barrier(Grid.comm);
+
+    free(bytes);
+    free(temp_path);
+}
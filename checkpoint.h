@@ -0,0 +1,38 @@
+#ifndef _CHECKPOINT_H_
+#define _CHECKPOINT_H_
+
+#include <stdint.h>
+
+#include "lib.h"
+
+#define CHECKPOINT_MAGIC "GOLCKPT1"
+
+
+// A checkpoint is one file: this header, then the board row by row with one bit per cell (column c is bit c % 8
+// of byte c / 8 of its row, rows are padded to whole bytes). All integers are little-endian.
+struct checkpointHeader{
+    char magic[8];                    // CHECKPOINT_MAGIC
+    int64_t rows, cols;
+    int64_t generation;               // of the board in the file
+    uint64_t seed;                    // the initial board was drawn from
+    char rule[24];                    // B3/S23 notation, NUL terminated
+};
+
+
+// Collective. Set the board size and seed from the header of the file, before the grid is set up.
+// Returns the generation of the board in the file.
+long long readCheckpointHeader(const char *path);
+
+// Collective. Every process reads its own subboard (Grid.rows x Grid.cols ints, row-major), whatever the process
+// grid that wrote the file.
+void readCheckpoint(const char *path, int *block);
+
+void setupCheckpoints(long long generation);                 // generation of the board the game starts from
+int checkpointDue(int numIterations);
+
+// Collective. Write the board of numIterations generations after the start into --checkpoint-file, which is
+// replaced only once the new one is complete.
+void writeCheckpoint(struct subboard block, int numIterations);
+
+
+#endif
@@ -0,0 +1,65 @@
+#include <stdlib.h>  /* for malloc/free */
+
+#include "lib.h"
+#include "cycle.h"
+
+
+void setupCycleDetector(struct cycleDetector *cycle, int max_period){
+    cycle->max_period = max_period;
+    cycle->batched    = 0;
+    cycle->history    = malloc(sizeof(uint64_t) * (max_period > 0 ? max_period : 1));
+    cycle->generation = 0;
+    cycle->first      = 0;
+    cycle->period     = 0;
+    cycle->since      = 0;
+}
+
+void freeCycleDetector(struct cycleDetector *cycle){
+    free(cycle->history);
+}
+
+
+void clearCycleHistory(struct cycleDetector *cycle){
+    cycle->first = cycle->generation;
+}
+
+
+void recordState(struct cycleDetector *cycle, uint64_t hash){
+    int myid;
+
+    // the same subboard on another process must not cancel out in the combined hash
+    MPI_Comm_rank(Grid.comm, &myid);
+    if (cycle->batched < CYCLE_BATCH) cycle->batch[cycle->batched++] = mixHash(hash + mixHash((uint64_t) myid));
+}
+
+
+int checkCycle(struct cycleDetector *cycle){
+    uint64_t global[CYCLE_BATCH];
+    long long p, gen;
+    int i, myid, n = cycle->batched;
+
+    if (cycle->max_period <= 0) return 0;
+
+    MPI_Allreduce(cycle->batch, global, n, MPI_UINT64_T, MPI_BXOR, Grid.comm);
+    cycle->batched = 0;
+
+    for (i = 0; i < n && cycle->period == 0; i++){
+        gen = cycle->generation;
+        for (p = 1; p <= cycle->max_period && p <= gen - cycle->first; p++){
+            if (cycle->history[(gen - p) % cycle->max_period] == global[i]){
+                cycle->period = p;
+                cycle->since  = gen - p;
+                break;
+            }
+        }
+        cycle->history[gen % cycle->max_period] = global[i];
+        cycle->generation++;
+    }
+
+    MPI_Comm_rank(Grid.comm, &myid);
+    if (cycle->period != 0 && I_AM_MASTER(myid)){
+        printf("Generation %lld repeats generation %lld: the board cycles with period %lld.\n",
+               cycle->since + cycle->period, cycle->since, cycle->period);
+    }
+    return cycle->period != 0;
+}
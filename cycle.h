@@ -0,0 +1,36 @@
+#ifndef _CYCLE_H_
+#define _CYCLE_H_
+
+#include <stdint.h>
+
+#include "lib.h"
+
+#define CYCLE_BATCH 10                // generations between two checks, as for checkGlobalStateChanged
+
+
+// Detection of a board that repeats itself. Every process hashes its subboard each generation, the hashes of
+// a batch of generations are combined over all processes with one reduction, and the combined ones are compared
+// with the last max_period generations.
+struct cycleDetector{
+    int max_period;
+    uint64_t batch[CYCLE_BATCH];      // local hashes since the last check
+    int batched;
+    uint64_t *history;                // ring of the last max_period global hashes
+    long long generation;             // generations entered in the history
+    long long first;                  // first of them still comparable, see clearCycleHistory
+    long long period, since;          // the cycle found, period 0 if none yet
+};
+
+
+void setupCycleDetector(struct cycleDetector *cycle, int max_period);
+void freeCycleDetector(struct cycleDetector *cycle);
+
+// Forget the generations entered so far, after the blocks moved: the combined hash depends on which process holds
+// which cells, the same board laid out anew does not hash the same
+void clearCycleHistory(struct cycleDetector *cycle);
+
+void recordState(struct cycleDetector *cycle, uint64_t hash);           // hash of the local subboard of this generation
+int checkCycle(struct cycleDetector *cycle);                            // collective, whether the board repeats
+
+
+#endif
@@ -0,0 +1,191 @@
+#include <stdlib.h>  /* for malloc/free */
+#include <string.h>
+
+#include "lib.h"
+#include "engine.h"
+#include "pages.h"
+
+
+// The reference kernel: one int per cell in two padded buffers, read one generation and written the other
+struct intBoard{
+    int rows, cols, depth, pitch;
+    size_t size;                      // bytes of a buffer
+    int *buffer[2];
+    MPI_Win window[2];
+    struct halo halo[2];              // exchange of each buffer
+    int current;                      // buffer of the current generation
+    struct rollingHash hash;
+    long long generations, cells;     // see engineStats
+};
+
+
+static void *int_allocate(int rows, int cols, int depth){
+    struct intBoard *board = malloc(sizeof(struct intBoard));
+    int i;
+
+    board->rows        = rows;
+    board->cols        = cols;
+    board->depth       = depth;
+    board->pitch       = cols + 2*depth;
+    board->size        = sizeof(int) * (size_t) (rows + 2*depth) * board->pitch;
+    board->current     = 0;
+    board->generations = 0;
+    board->cells       = 0;
+    forgetRollingHash(&board->hash);
+
+    for (i = 0; i < 2; i++) {
+        board->buffer[i] = allocateSharedBoard(board->size, &board->window[i]);
+        touchRows(board->buffer[i], sizeof(int) * board->pitch, rows + 2*depth);
+    }
+    for (i = 0; i < 2; i++) {
+        setupPaddedHalo(&board->halo[i], board->buffer[i], board->window[i], MPI_INT, rows, cols, board->pitch, depth);
+    }
+    return board;
+}
+
+static void int_free(void *cells){
+    struct intBoard *board = cells;
+    int i;
+
+    for (i = 0; i < 2; i++) {
+        freeHalo(&board->halo[i]);
+        freeSharedBoard(board->buffer[i], board->size, &board->window[i]);
+    }
+    free(board);
+}
+
+
+static int *int_cell(const struct intBoard *board, int buffer, int row, int col){
+    return &board->buffer[buffer][(size_t) (row + board->depth) * board->pitch + col + board->depth];
+}
+
+static void int_put_region(void *cells, struct region region, const int *in){
+    struct intBoard *board = cells;
+    int row, width = region.col_to - region.col_from;
+
+    for (row = region.row_from; row < region.row_to; row++, in += width) {
+        memcpy(int_cell(board, board->current, row, region.col_from), in, sizeof(int) * width);
+    }
+    forgetRollingHash(&board->hash);
+}
+
+static void int_get_region(const void *cells, struct region region, int *out){
+    const struct intBoard *board = cells;
+    int row, width = region.col_to - region.col_from;
+
+    for (row = region.row_from; row < region.row_to; row++, out += width) {
+        memcpy(out, int_cell(board, board->current, row, region.col_from), sizeof(int) * width);
+    }
+}
+
+
+static void int_start_halo(void *cells){
+    struct intBoard *board = cells;
+    startHalo(&board->halo[board->current]);
+}
+
+static void int_progress_halo(void *cells){
+    struct intBoard *board = cells;
+    progressHalo(&board->halo[board->current]);
+}
+
+static void int_finish_halo(void *cells){
+    struct intBoard *board = cells;
+    finishHalo(&board->halo[board->current]);
+}
+
+static int int_step(void *cells, struct region region){
+    struct intBoard *board = cells;
+    int *next = board->buffer[1 - board->current];
+    int flag;
+
+    countCells(&board->cells, region);
+    flag = evolveIntBand(board->buffer[board->current], next, board->pitch, region);
+    if (rollingHashes()) {
+        addBandHash(&board->hash, hashPaddedBand(next, sizeof(int), board->rows, board->cols, board->pitch, board->depth, threadBand(region)));
+    }
+    return flag;
+}
+
+static void int_swap(void *cells){
+    struct intBoard *board = cells;
+
+    board->current = 1 - board->current;
+    board->generations++;
+    swapRollingHash(&board->hash);
+}
+
+static uint64_t int_hash(void *cells){
+    struct intBoard *board = cells;
+
+    if (!board->hash.known) {
+        setRollingHash(&board->hash, hashPaddedBoard(board->buffer[board->current], sizeof(int), board->rows, board->cols,
+                                                     board->pitch, board->depth));
+    }
+    return board->hash.current;
+}
+
+static void int_stats(const void *cells, struct engineStats *stats){
+    const struct intBoard *board = cells;
+
+    stats->generations += board->generations;
+    stats->cells       += board->cells;
+    stats->bytes        = 2 * (long long) board->size;
+}
+
+
+const struct engine IntEngine = {
+    "int", int_allocate, int_put_region, int_get_region, NULL, int_start_halo, int_progress_halo, int_finish_halo,
+    int_step, NULL, int_swap, int_hash, int_stats, int_free
+};
+
+
+// in the order of the KERNEL_* values
+static const struct engine *engines[] = {&IntEngine, &PackedEngine, &SimdEngine, &TiledEngine, &FlatEngine};
+
+const struct engine *kernelEngine(int kernel){
+    return engines[kernel];
+}
+
+int findKernel(const char *name){
+    int kernel;
+
+    for (kernel = 0; kernel < (int) (sizeof(engines) / sizeof(engines[0])); kernel++) {
+        if (strcmp(name, engines[kernel]->name) == 0) return kernel;
+    }
+    return -1;
+}
+
+
+// every thread is given the same region, one of them counts it
+void countCells(long long *cells, struct region region){
+#pragma omp master
+    *cells += (long long) (region.row_to - region.row_from) * (region.col_to - region.col_from);
+}
+
+
+// only the cycle detector needs the hashes
+int rollingHashes(void){
+    return Params.max_period > 0;
+}
+
+void addBandHash(struct rollingHash *hash, uint64_t band){
+#pragma omp atomic
+    hash->next ^= band;
+}
+
+void swapRollingHash(struct rollingHash *hash){
+    hash->current = hash->next;
+    hash->next    = 0;
+    hash->known   = rollingHashes();
+}
+
+void setRollingHash(struct rollingHash *hash, uint64_t current){
+    hash->current = current;
+    hash->known   = 1;
+}
+
+void forgetRollingHash(struct rollingHash *hash){
+    hash->next  = 0;
+    hash->known = 0;
+}
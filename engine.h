@@ -0,0 +1,74 @@
+#ifndef _ENGINE_H_
+#define _ENGINE_H_
+
+#include <stdint.h>
+
+#include "lib.h"
+
+
+// What an engine measured of its game, see stats
+struct engineStats{
+    long long generations;            // played on the board
+    long long cells;                  // cell updates computed, the ghost cells recomputed between exchanges included
+    long long tiles, computed_tiles;  // tiles visited and computed by an engine that skips the quiet ones, 0 otherwise
+    long long bytes;                  // memory the board takes now, its buffers included
+};
+
+// A kernel as the game loop drives it, chosen with --kernel (or --engine). An engine keeps the subboard of the
+// process in its own format, padded with Params.halo_depth ghost cells on each side. The loop runs in a single team
+// of threads: the functions marked "all threads" are called by every thread of the team, the others by its master,
+// the only thread that talks to MPI.
+//
+// A generation of the loop: the master sends the edges (startHalo), every thread computes its band of the cells that
+// need no ghost cells (step, in two halves when the master has to move the exchange on in between with progressHalo),
+// the master waits for the ghost cells (finishHalo), then the threads compute the frame left (frame). Between two exchanges, and without a halo, step computes the whole region of the generation.
+// Playing n generations is the loop's part (see playGame), so that the printing, the files and the cycle detector
+// come between two generations whatever the engine.
+struct engine{
+    const char *name;                                                 // as given to --kernel
+    void *(*allocate)(int rows, int cols, int depth);                 // collective, a rows x cols subboard
+    void (*putRegion)(void *board, struct region region, const int *in);    // store 0/1 ints, row after row, in a
+                                                                      // region of the subboard (without ghost cells)
+    void (*getRegion)(const void *board, struct region region, int *out);   // load them
+    void (*init)(void *board);                                        // once all the cells are in, NULL if nothing to do
+    void (*startHalo)(void *board);                                   // NULL for a board without ghost cells
+    void (*progressHalo)(void *board);                                // halfway through the inner step, NULL if the
+                                                                      // exchange has nothing to do then
+    void (*finishHalo)(void *board);
+    int (*step)(void *board, struct region region);                   // all threads: next state of their band of a
+                                                                      // region in padded coordinates, whether it changed
+    int (*frame)(void *board, struct region outer, struct region inner);   // all threads: the same for outer minus
+                                                                      // inner, NULL to step over its strips
+    void (*swap)(void *board);                                        // make the next generation the current one
+    uint64_t (*hash)(void *board);                                    // of the cells of the subboard
+    void (*stats)(const void *board, struct engineStats *stats);      // add what it measured since allocate, set bytes
+    void (*free)(void *board);                                        // collective
+};
+
+// The hash of the board of an engine, kept up to date by its steps: each thread hashes the pieces of the subboard it
+// wrote (see hashPieces) and adds them into next, which becomes the hash of the current generation with the swap.
+// It is computed in full only when it is not known, at the start or once cells were put in.
+struct rollingHash{
+    uint64_t current, next;
+    int known;                        // whether current is the hash of the current generation
+};
+
+extern const struct engine IntEngine;       // engine.c
+extern const struct engine PackedEngine;    // packed.c
+extern const struct engine SimdEngine;      // simd.c
+extern const struct engine TiledEngine;     // tiles.c
+extern const struct engine FlatEngine;      // flat.c
+
+const struct engine *kernelEngine(int kernel);                       // of one of the KERNEL_* values
+int findKernel(const char *name);                                    // KERNEL_* value of an engine, -1 if none has this name
+
+void countCells(long long *cells, struct region region);             // all threads: add the cells of a step to a count
+
+int rollingHashes(void);                                             // whether the steps have to hash what they wrote
+void addBandHash(struct rollingHash *hash, uint64_t band);           // all threads: add the hash of the pieces of a band
+void swapRollingHash(struct rollingHash *hash);                      // next becomes current
+void setRollingHash(struct rollingHash *hash, uint64_t current);     // computed in full
+void forgetRollingHash(struct rollingHash *hash);                    // the board changed outside of the steps
+
+
+#endif
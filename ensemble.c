@@ -0,0 +1,204 @@
+#include <stdlib.h>  /* for malloc/free */
+#include <string.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "lib.h"
+#include "packed.h"
+#include "ensemble.h"
+
+#define LANES WORD_BITS               // boards of a group, one per bit of a word
+
+
+struct boardResult{
+    unsigned long long seed;
+    int probability;
+    int settled;                      // first generation of the cycle it ended in, -1 if none was found
+    int period;
+    long long population;             // alive cells in the last generation played
+};
+
+
+// seed and probability of board b of the ensemble, the seeds of a probability come one after the other
+static void board_params(long long b, unsigned long long *seed, int *probability){
+    *seed        = Params.seed + (unsigned long long) (b % Params.ensemble);
+    *probability = Params.alive_probability + (int) (b / Params.ensemble);
+}
+
+
+// Next generation of the boards of a group, each a rows x cols torus. As evolve_word in packed.c, but the bits of a
+// word are the same cell of different boards, so the neighbours are whole words.
+static void evolve_planes(const uint64_t *cells, uint64_t *next, int rows, int cols, unsigned born, unsigned survive){
+    const uint64_t *up, *mid, *down;
+    uint64_t s0, c0, s1, c1, s2, c2, ones, c3, t0, f0, twos, f1, fours, eights, m;
+    int row, col, left, right;
+
+    for (row = 0; row < rows; row++){
+        up   = &cells[(size_t) mod(row - 1, rows) * cols];
+        mid  = &cells[(size_t) row * cols];
+        down = &cells[(size_t) mod(row + 1, rows) * cols];
+
+        for (col = 0; col < cols; col++){
+            left  = (col == 0) ? cols - 1 : col - 1;
+            right = (col == cols - 1) ? 0 : col + 1;
+            m     = mid[col];
+
+            FULL_ADD(s0, c0, up[left], up[col], up[right]);
+            FULL_ADD(s1, c1, down[left], down[col], down[right]);
+            HALF_ADD(s2, c2, mid[left], mid[right]);
+            FULL_ADD(ones, c3, s0, s1, s2);
+            FULL_ADD(t0, f0, c0, c1, c2);
+            HALF_ADD(twos, f1, t0, c3);
+            fours  = f0 ^ f1;
+            eights = f0 & f1;
+
+            if (born == RULE_CONWAY_BORN && survive == RULE_CONWAY_SURVIVE){
+                next[(size_t) row * cols + col] = twos & ~fours & ~eights & (ones | m);
+            }else{
+                next[(size_t) row * cols + col] = countIn(born & survive, ones, twos, fours, eights)
+                                                | (countIn(born & ~survive, ones, twos, fours, eights) & ~m)
+                                                | (countIn(survive & ~born, ones, twos, fours, eights) & m);
+            }
+        }
+    }
+}
+
+
+// Play the boards first .. first+boards-1 in the lanes of one group. planes holds history+1 generations of the
+// group: the current one, the history before it, and the next one in place of the oldest. Returns the generations
+// played.
+static int play_group(long long first, int boards, int history, uint64_t **planes, int *scratch, struct boardResult *results){
+    int rows = Params.Rows, cols = Params.Cols, lane, generation, current = 0, next, k, slot;
+    size_t size = (size_t) rows * cols, i;
+    uint64_t used = (boards == LANES) ? ~0ULL : (1ULL << boards) - 1, settled = 0, differ, repeat;
+
+    memset(planes[0], 0, size * sizeof(uint64_t));
+    for (lane = 0; lane < boards; lane++){
+        board_params(first + lane, &results[lane].seed, &results[lane].probability);
+        initializeBoard(scratch, rows, cols, 0, 0, results[lane].probability, results[lane].seed);
+        for (i = 0; i < size; i++) planes[0][i] |= (uint64_t) scratch[i] << lane;
+
+        results[lane].settled    = -1;
+        results[lane].period     = 0;
+        results[lane].population = 0;
+    }
+
+    for (generation = 1; settled != used && (Params.max_iterations == -1 || generation <= Params.max_iterations); generation++){
+        next = (current + 1) % (history + 1);
+        evolve_planes(planes[current], planes[next], rows, cols, Rule.born, Rule.survive);
+
+        // the shortest period first: generation - 1 is in current, generation - 2 in the slot before, ...
+        for (k = 0; k < history && k < generation; k++){
+            slot   = mod(current - k, history + 1);
+            differ = 0;
+            for (i = 0; i < size; i++) differ |= planes[next][i] ^ planes[slot][i];
+
+            repeat = ~differ & used & ~settled;
+            for (lane = 0; lane < boards; lane++){
+                if (repeat >> lane & 1){
+                    results[lane].settled = generation - (k + 1);
+                    results[lane].period  = k + 1;
+                }
+            }
+            settled |= repeat;
+        }
+        current = next;
+    }
+
+    for (i = 0; i < size; i++){
+        for (lane = 0; lane < boards; lane++) results[lane].population += planes[current][i] >> lane & 1;
+    }
+    return generation - 1;
+}
+
+
+// The processes write their lines one after the other, the master first with the header
+static void write_results(const struct boardResult *results, long long count){
+    int myid;
+    size_t size = 64 + (size_t) count * 96, length = 0;
+    char *text = malloc(size);
+    long long i, offset = 0, bytes;
+    MPI_File file;
+
+    MPI_Comm_rank(MPI_COMM_WORLD, &myid);
+
+    if (I_AM_MASTER(myid)) length += sprintf(text + length, "seed,alive_prob,settled,period,population\n");
+    for (i = 0; i < count; i++){
+        length += sprintf(text + length, "%llu,%d,%d,%d,%lld\n", results[i].seed, results[i].probability,
+                          results[i].settled, results[i].period, results[i].population);
+    }
+
+    bytes = (long long) length;
+    MPI_Exscan(&bytes, &offset, 1, MPI_LONG_LONG, MPI_SUM, MPI_COMM_WORLD);
+    if (I_AM_MASTER(myid)) offset = 0;
+
+    if (MPI_File_open(MPI_COMM_WORLD, (char *) Params.ensemble_file, MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &file) != MPI_SUCCESS){
+        if (I_AM_MASTER(myid)) fprintf(stderr, "Could not write the results of the ensemble to `%s'.\n", Params.ensemble_file);
+        free(text);
+        return;
+    }
+    MPI_File_set_size(file, 0);
+    MPI_File_write_at_all(file, offset, text, (int) length, MPI_BYTE, MPI_STATUS_IGNORE);
+    MPI_File_close(&file);
+    free(text);
+}
+
+
+void playEnsemble(void){
+    int myid, numprocs, history = (Params.max_period > 1) ? Params.max_period : 1;
+    long long total = (long long) Params.ensemble * (Params.alive_probability_to - Params.alive_probability + 1);
+    long long groups = (total + LANES - 1) / LANES, first, count, g, boards, work[2] = {0, 0};
+    struct boardResult *results;
+    double start_t, seconds;
+
+    MPI_Comm_rank(MPI_COMM_WORLD, &myid);
+    MPI_Comm_size(MPI_COMM_WORLD, &numprocs);
+
+    // whole groups for every process, in order
+    first   = groups / numprocs * myid + (myid < groups % numprocs ? myid : groups % numprocs);
+    count   = groups / numprocs + (myid < groups % numprocs);
+    boards  = (first + count) * LANES < total ? count * LANES : total - first * LANES;
+    if (boards < 0) boards = 0;
+    results = malloc(sizeof(struct boardResult) * (boards > 0 ? boards : 1));
+
+    if (I_AM_MASTER(myid)) printf("Playing an ensemble of %lld %d x %d boards, %s.\n", total, Params.Rows, Params.Cols, Rule.name);
+
+    MPI_Barrier(MPI_COMM_WORLD);
+    start_t = MPI_Wtime();
+
+#pragma omp parallel private(g)
+    {
+        size_t size = (size_t) Params.Rows * Params.Cols;
+        uint64_t **planes = malloc(sizeof(uint64_t *) * (history + 1));
+        int *scratch = malloc(sizeof(int) * size), generations, lanes, k;
+
+        for (k = 0; k <= history; k++) planes[k] = malloc(sizeof(uint64_t) * size);
+
+        // the groups settle after very different numbers of generations, a thread takes the next one when it is done
+#pragma omp for schedule(dynamic, 1) reduction(+:work[:2])
+        for (g = first; g < first + count; g++){
+            lanes       = (g + 1) * LANES <= total ? LANES : (int) (total - g * LANES);
+            generations = play_group(g * LANES, lanes, history, planes, scratch, &results[(g - first) * LANES]);
+            work[0]    += (long long) generations * lanes;
+            work[1]    += generations;
+        }
+
+        for (k = 0; k <= history; k++) free(planes[k]);
+        free(planes);
+        free(scratch);
+    }
+
+    seconds = MPI_Wtime() - start_t;
+    MPI_Allreduce(MPI_IN_PLACE, &seconds, 1, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+    MPI_Allreduce(MPI_IN_PLACE, work, 2, MPI_LONG_LONG, MPI_SUM, MPI_COMM_WORLD);
+    if (I_AM_MASTER(myid)){
+        printf("Played %lld board generations in %f sec (%lld group generations), %.3e cell generations per second.\n",
+               work[0], seconds, work[1], seconds > 0 ? (double) work[0] * Params.Rows * Params.Cols / seconds : 0.0);
+    }
+
+    write_results(results, boards);
+    if (I_AM_MASTER(myid)) printf("Wrote the results of the boards to %s.\n", Params.ensemble_file);
+    free(results);
+}
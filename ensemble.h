@@ -0,0 +1,21 @@
+#ifndef _ENSEMBLE_H_
+#define _ENSEMBLE_H_
+
+#include "lib.h"
+
+
+// Ensemble mode (--ensemble), for sweeps over many small boards in one job. Every probability from
+// Params.alive_probability to Params.alive_probability_to is drawn with Params.ensemble seeds, starting at
+// Params.seed: each board is the one a single game with that seed and probability would start from, on its own torus.
+//
+// The boards are interleaved by 64 in bit-planes: bit b of a word is a cell of board b of the group, so one bitwise
+// adder tree advances the same cell of 64 boards. The groups are split over the processes, then handed out to the
+// threads one at a time as they finish the previous one. A board is settled once it repeats one of its last
+// max(Params.max_period, 1) generations; a group stops when all its boards have settled, or at Params.max_iterations.
+
+// Collective. Play the ensemble and write one CSV line per board to Params.ensemble_file: its seed and probability,
+// the generation it settled at (-1 if it did not), its period and its final population.
+void playEnsemble(void);
+
+
+#endif
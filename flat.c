@@ -0,0 +1,168 @@
+#include <stdlib.h>  /* for malloc/free */
+#include <string.h>
+
+#include "lib.h"
+#include "flat.h"
+#include "engine.h"
+#include "pages.h"
+#include "timing.h"
+
+
+void allocateFlatBoard(struct flatBoard *board, int rows, int cols){
+    board->rows  = rows;
+    board->cols  = cols;
+    board->cells = allocateBoard(sizeof(int) * (size_t) rows * cols);
+    board->next  = allocateBoard(sizeof(int) * (size_t) rows * cols);
+    touchRows(board->cells, sizeof(int) * cols, rows);
+    touchRows(board->next,  sizeof(int) * cols, rows);
+}
+
+void freeFlatBoard(struct flatBoard *board){
+    freeBoard(board->cells, sizeof(int) * (size_t) board->rows * board->cols);
+    freeBoard(board->next,  sizeof(int) * (size_t) board->rows * board->cols);
+}
+
+
+void setFlatRegion(struct flatBoard *board, struct region region, const int *in){
+    int row, width = region.col_to - region.col_from;
+
+    for (row = region.row_from; row < region.row_to; row++, in += width){
+        memcpy(&board->cells[(size_t) row * board->cols + region.col_from], in, sizeof(int) * width);
+    }
+}
+
+void getFlatRegion(const struct flatBoard *board, struct region region, int *out){
+    int row, width = region.col_to - region.col_from;
+
+    for (row = region.row_from; row < region.row_to; row++, out += width){
+        memcpy(out, &board->cells[(size_t) row * board->cols + region.col_from], sizeof(int) * width);
+    }
+}
+
+
+// The CUDA kernel counted all the neighbours into a sums array before updating the board in place, which raced
+// between the blocks; here the next generation goes to the other buffer in the same pass, through the rule table.
+// Its index functions took a modulo and a division for each neighbour of each cell, the rows above and below are
+// found once per row instead and only the first and last columns wrap around.
+int evolveFlatBand(struct flatBoard *board, struct region region){
+    struct region band = threadBand(region);
+    const int *up, *mid, *down;
+    int *next;
+    int rows = board->rows, cols = board->cols;
+    int row, col, left, right, sum, state, flag = 0;
+    double busy = phaseClock();
+
+    for (row = band.row_from; row < band.row_to; row++){
+        up   = &board->cells[(size_t) mod(row - 1, rows) * cols];
+        mid  = &board->cells[(size_t) row * cols];
+        down = &board->cells[(size_t) mod(row + 1, rows) * cols];
+        next = &board->next[(size_t) row * cols];
+
+        for (col = band.col_from; col < band.col_to; col++){
+            left  = (col == 0) ? cols - 1 : col - 1;
+            right = (col == cols - 1) ? 0 : col + 1;
+
+            sum =   up[left]   + up[col]   + up[right]
+                  + mid[left]              + mid[right]
+                  + down[left] + down[col] + down[right];
+
+            state = Rule.next[mid[col]][sum];
+            flag |= state ^ mid[col];
+            next[col] = state;
+        }
+    }
+    lapThread(busy);
+    return flag;
+}
+
+
+void swapFlatBoard(struct flatBoard *board){
+    int *temp = board->cells;
+    board->cells = board->next;
+    board->next  = temp;
+}
+
+
+uint64_t hashFlatBoard(const struct flatBoard *board){
+    return hashPaddedBoard(board->cells, sizeof(int), board->rows, board->cols, board->cols, 0);
+}
+
+
+// The flat kernel as an engine (see engine.h). The board wraps around by itself, there is no halo to exchange.
+struct flatEngine{
+    struct flatBoard board;
+    struct rollingHash hash;
+    long long generations, cells;     // see engineStats
+};
+
+static void *flat_allocate(int rows, int cols, int depth){
+    struct flatEngine *engine = malloc(sizeof(struct flatEngine));
+
+    allocateFlatBoard(&engine->board, rows, cols);
+    engine->generations = 0;
+    engine->cells       = 0;
+    forgetRollingHash(&engine->hash);
+    return engine;
+}
+
+static void flat_free(void *board){
+    struct flatEngine *engine = board;
+
+    freeFlatBoard(&engine->board);
+    free(engine);
+}
+
+static void flat_put_region(void *board, struct region region, const int *in){
+    struct flatEngine *engine = board;
+
+    setFlatRegion(&engine->board, region, in);
+    forgetRollingHash(&engine->hash);
+}
+
+static void flat_get_region(const void *board, struct region region, int *out){
+    getFlatRegion(&((const struct flatEngine *) board)->board, region, out);
+}
+
+// the regions are given in the padded coordinates of a halo one cell deep, the board has no padding
+static int flat_step(void *board, struct region region){
+    struct flatEngine *engine = board;
+    struct region cells = {region.row_from - 1, region.row_to - 1, region.col_from - 1, region.col_to - 1};
+
+    int flag;
+
+    countCells(&engine->cells, cells);
+    flag = evolveFlatBand(&engine->board, cells);
+    if (rollingHashes()) {
+        addBandHash(&engine->hash, hashPaddedBand(engine->board.next, sizeof(int), engine->board.rows, engine->board.cols,
+                                                  engine->board.cols, 0, threadBand(cells)));
+    }
+    return flag;
+}
+
+static void flat_swap(void *board){
+    struct flatEngine *engine = board;
+
+    swapFlatBoard(&engine->board);
+    engine->generations++;
+    swapRollingHash(&engine->hash);
+}
+
+static uint64_t flat_hash(void *board){
+    struct flatEngine *engine = board;
+
+    if (!engine->hash.known) setRollingHash(&engine->hash, hashFlatBoard(&engine->board));
+    return engine->hash.current;
+}
+
+static void flat_stats(const void *board, struct engineStats *stats){
+    const struct flatEngine *engine = board;
+
+    stats->generations += engine->generations;
+    stats->cells       += engine->cells;
+    stats->bytes        = 2 * (long long) sizeof(int) * engine->board.rows * engine->board.cols;
+}
+
+const struct engine FlatEngine = {
+    "flat", flat_allocate, flat_put_region, flat_get_region, NULL, NULL, NULL, NULL, flat_step, NULL,
+    flat_swap, flat_hash, flat_stats, flat_free
+};
@@ -0,0 +1,31 @@
+#ifndef _FLAT_H_
+#define _FLAT_H_
+
+#include <stdint.h>
+
+#include "lib.h"
+
+
+// The kernel of the CUDA version (game-of-life.cu) ported to the host. The board is one flat array of rows x cols
+// ints without ghost cells, and the neighbours of a cell wrap around its edges, which makes it a torus by itself:
+// it plays the whole board on one process, with the threads of the team in place of the CUDA blocks.
+struct flatBoard{
+    int rows;
+    int cols;
+    int *cells;                       // current generation, rows * cols ints
+    int *next;                        // next generation is written here, then the two are swapped
+};
+
+
+void allocateFlatBoard(struct flatBoard *board, int rows, int cols);
+void freeFlatBoard(struct flatBoard *board);
+
+void setFlatRegion(struct flatBoard *board, struct region region, const int *in);   // store ints, row after row
+void getFlatRegion(const struct flatBoard *board, struct region region, int *out);  // load them
+
+int evolveFlatBand(struct flatBoard *board, struct region region);      // next state of the calling thread's band of a region
+void swapFlatBoard(struct flatBoard *board);                             // make the next generation the current one
+uint64_t hashFlatBoard(const struct flatBoard *board);                  // hash of the cells of the board
+
+
+#endif
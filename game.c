@@ -3,158 +3,428 @@
 #include <time.h>
 #include <stdlib.h>
 #include <stdio.h>
-#include <math.h>
+#include <string.h>
 
 #include <omp.h>
 
 #include "lib.h"
+#include "simd.h"
+#include "engine.h"
+#include "hashlife.h"
+#include "cycle.h"
+#include "checkpoint.h"
+#include "snapshot.h"
+#include "pattern.h"
+#include "timing.h"
+#include "affinity.h"
+#include "pages.h"
+#include "balance.h"
+#include "ensemble.h"
+
+
+
+
+// gather the subboards on the master and print them (the master passes its own subboard in temp)
+static void printGeneration(int myid, int numprocs, int *temp, int ***in){
+    int i;
+
+    if (I_AM_MASTER(myid)) { // gather sub-tables to print
+
+        in[0][0] = temp;
+        if (numprocs != 1) receiveAllStates(in);
+        for (i = 0; i < 2; i++) { printf("\n"); }
+        printState(in);
+        usleep(333 * 1000); // stalling for seeing live results on screen
+    } else {
+        sendLocalStateToMaster(temp, Grid.rows * Grid.cols); // send current state for printing
+    }
+}
 
 
+static int gameOver;                  // nothing changed any more, or the board repeats itself
 
+// Every 10 generations the processes agree whether to go on: not if nothing changed, or if the board repeats itself.
+// They also do at the end of an epoch, so that the hashes of a batch it cut short are not lost.
+static int keepPlaying(int numIterations, int last, int myChange, struct cycleDetector *cycle){
+    if (numIterations % CYCLE_BATCH != 0 && numIterations != last) return 1;
+    gameOver = !checkGlobalStateChanged(myChange) || checkCycle(cycle);
+    return !gameOver;
+}
 
 
+// the clock starts with the first generation, the next epochs of --balance carry on with it
+static void startClock(int played, double *start_t){
+    if (played > 0) return;
 
+    MPI_Barrier(MPI_COMM_WORLD);
+    *start_t = MPI_Wtime();
+}
 
 
-int main(int argc, char **argv)
-{
-    int myid, numprocs;
-    int width;
-    int i, j;
-    int myChange, someChangeHappened = 1;
-    int numIterations =0;
+// the clock and the phase timers start over once the warm-up generations are played
+static void endWarmup(int numIterations, double *start_t){
+    if (numIterations != Params.warmup_generations) return;
 
-    MPI_Init(&argc,&argv);
+    MPI_Barrier(MPI_COMM_WORLD);
+    *start_t = MPI_Wtime();
+    resetPhases();
+}
 
 
-    MPI_Comm_size(MPI_COMM_WORLD,&numprocs);
-    MPI_Comm_rank(MPI_COMM_WORLD, &myid);
+// the subboard of an engine as the files read it
+static struct subboard engine_subboard(const struct engine *engine, const void *board){
+    struct subboard subboard = {board, engine->getRegion};
+    return subboard;
+}
 
-    parseCommandLineArguments(argc, argv);
+// Collective. A new board of the engine holding a block of Grid.rows x Grid.cols ints, the block is freed: the game
+// keeps no int copy of its board
+static void *load_board(const struct engine *engine, int *block){
+    struct region whole = {0, Grid.rows, 0, Grid.cols};
+    void *board = engine->allocate(Grid.rows, Grid.cols, Params.halo_depth);
 
+    engine->putRegion(board, whole, block);
+    if (engine->init != NULL) engine->init(board);
+    freeBoard(block, sizeof(int) * (size_t) Grid.rows * Grid.cols);
+    return board;
+}
 
-    width = (int) sqrt(Params.Rows*Params.Cols/numprocs); //todo...
-    srand(myid*(unsigned)time(NULL));
+// Collective. The reverse: the block of a board of the engine, which is freed once stats has what it measured
+static int *unload_board(const struct engine *engine, void *board, struct engineStats *stats){
+    struct region whole = {0, Grid.rows, 0, Grid.cols};
+    int *block = allocateBoard(sizeof(int) * (size_t) Grid.rows * Grid.cols);
 
-    int temp[width*width];
-    int sums[width*width];
-    int *** in;
+    engine->getRegion(board, whole, block);
+    engine->stats(board, stats);
+    engine->free(board);
+    return block;
+}
 
 
-    int up_buffer[width];
-    int down_buffer[width];
-    int left_buffer[width];
-    int right_buffer[width];
-    int up_left_buffer;
-    int up_right_buffer;
-    int down_left_buffer;
-    int down_right_buffer;
+// The game loop of every kernel, driven through its engine (see engine.h) on a board loaded by load_board. It plays
+// from generation played + 1 up to last (-1 for no end), unless the game is over before, and returns the last
+// generation played. main calls it once, or once per epoch between two load measures with --balance: the board, its
+// halos and the cycle detector go on over the epochs, until the blocks move. The board is only converted to ints for
+// the printing.
+//
+// The loop runs in a single team of threads for the whole game, and only its master thread talks to MPI
+// (MPI_THREAD_FUNNELED). Every thread computes its band of the inner cells while the master also starts the halo
+// exchange, and moves it on halfway, then the band of the frame once the master has received the ghost cells. The master swaps the buffers
+// and decides whether to go on between the two barriers closing a generation.
+static int playGame(const struct engine *engine, void *board, int myid, int numprocs, int ***in, int played, int last,
+                    struct cycleDetector *cycle, double *start_t){
+    int i, step, strips, flag, exchange, generation = played;
+    int myChange = 0, someChangeHappened = 1;
+    int numIterations = played;
+    double lap;                       // start of the current phase
+    int depth = Params.halo_depth;
+    struct region region, inner = innerRegion(Grid.rows, Grid.cols, depth), frame[4];
+    struct region halves[2] = {inner, inner};   // of the inner region, for progressHalo
+    struct region whole = {0, Grid.rows, 0, Grid.cols};
+    int *cells = Params.should_print ? malloc(sizeof(int) * Grid.rows * Grid.cols) : NULL;   // the printed subboard
+
+    halves[0].row_to = halves[1].row_from = (inner.row_from + inner.row_to) / 2;
+
+    // last == -1 means infinite loops
+    startClock(played, start_t);
+
+#pragma omp parallel private(i, step, strips, flag, exchange, region, frame) firstprivate(generation)
+    while(someChangeHappened && (  (last == -1) ? 1 : generation < last)){
+        generation++;
+
+        // the halos are exchanged every depth generations, in between the ghost cells are recomputed locally
+        step     = (generation - played - 1) % depth;
+        region   = stepRegion(Grid.rows, Grid.cols, depth, step);
+        exchange = (step == 0 && engine->startHalo != NULL);
+
+#pragma omp master
+        {
+            numIterations = generation;
+            lap = phaseClock();
+
+            if (Params.should_print) {
+                engine->getRegion(board, whole, cells);
+                printGeneration(myid, numprocs, cells, in);
+            }
 
-    MPI_Request sHandlerUp, sHandlerDown, sHandlerLeft, sHandlerRight, sHandlerUpLeft, sHandlerUpRight, sHandlerDownLeft, sHandlerDownRight;
-    MPI_Request rHandlerUp, rHandlerDown, rHandlerLeft, rHandlerRight, rHandlerUpLeft, rHandlerUpRight, rHandlerDownLeft, rHandlerDownRight;
+            if (Params.max_period > 0) recordState(cycle, engine->hash(board));
+            lapPhase(PHASE_OTHER, &lap);
 
+            if (exchange) {
+                engine->startHalo(board);
+                lapPhase(PHASE_HALO, &lap);
+            }
+        }
 
+        if (exchange) {
+            if (engine->progressHalo != NULL) {
+                flag = engine->step(board, halves[0]);
 
+#pragma omp master
+                {
+                    lapPhase(PHASE_INNER, &lap);
+                    engine->progressHalo(board);
+                    lapPhase(PHASE_HALO, &lap);
+                }
 
-    if (I_AM_MASTER(myid) && Params.should_print) {
-        in = malloc(sizeof(int *) * ((int) sqrt(numprocs)));
-        for (i = 0; i < (int) sqrt(numprocs); i++) in[i] = malloc(sizeof(int) * ((int) sqrt(numprocs)));
-    }else{
-        in = NULL;
-    }
+                flag |= engine->step(board, halves[1]);
+            } else {
+                flag = engine->step(board, inner);
+            }
 
+#pragma omp master
+            {
+                lapPhase(PHASE_INNER, &lap);
+                engine->finishHalo(board);
+                lapPhase(PHASE_HALO, &lap);
+            }
+#pragma omp barrier
 
-    initializeBoard(temp, width, width, Params.alive_probability);
+            if (engine->frame != NULL) {
+                flag |= engine->frame(board, region, inner);
+            } else {
+                strips = frameRegions(region, inner, frame);
+                for (i = 0; i < strips; i++) flag |= engine->step(board, frame[i]);
+            }
+        } else {
+            flag = engine->step(board, region);
+        }
 
+        if (flag) {
+#pragma omp atomic
+            myChange |= flag;
+        }
+#pragma omp barrier
 
-    // max_iterations == -1 means infinite loops
-    MPI_Barrier(MPI_COMM_WORLD);
-    double start_t = MPI_Wtime();
-    while(someChangeHappened && (  (Params.max_iterations == -1) ? 1 : numIterations < Params.max_iterations)){
-        numIterations++;
+#pragma omp master
+        {
+            lapPhase(exchange ? PHASE_BORDER : PHASE_INNER, &lap);
+            engine->swap(board);
 
-        if (Params.should_print) {
+            if (checkpointDue(generation)) writeCheckpoint(engine_subboard(engine, board), generation);
+            if (snapshotDue(generation)) writeSnapshot(engine_subboard(engine, board), generation);
 
-            if (I_AM_MASTER(myid)) { // gather sub-tables to print
+            lapPhase(PHASE_OTHER, &lap);
 
-                in[0][0] = temp;
-                if (numprocs != 1) receiveAllStates(numprocs, in, width);
-                for (i = 0; i < 2; i++) { printf("\n"); }
-                printState(numprocs, width, in);
-                usleep(333 * 1000); // stalling for seeing live results on screen
-            } else {
-                sendLocalStateToMaster(temp, width * width); // send current state for printing
-            }
+            someChangeHappened = keepPlaying(generation, last, myChange, cycle);
+            myChange = 0;
+            lapPhase(PHASE_REDUCE, &lap);
+            endWarmup(generation, start_t);
         }
+#pragma omp barrier
 
+    }// end of game loop
 
-        sendPeripheralsToNeighbours(myid, temp, width, numprocs,
-                                        &sHandlerUp, &sHandlerDown, &sHandlerLeft, &sHandlerRight, &sHandlerUpLeft, &sHandlerUpRight,
-                                        &sHandlerDownLeft, &sHandlerDownRight);
-
-        receivePeripheralsFromNeighbours(myid, width, numprocs,
-                                         up_buffer, down_buffer, left_buffer, right_buffer, &up_left_buffer,
-                                         &up_right_buffer, &down_left_buffer, &down_right_buffer,
-                                         &rHandlerUp, &rHandlerDown, &rHandlerLeft, &rHandlerRight, &rHandlerUpLeft, &rHandlerUpRight,
-                                         &rHandlerDownLeft, &rHandlerDownRight);
+    free(cells);
+    return numIterations;
+}
 
 
-        if (Params.numthreads != -1) {
 
-            //todo: documentation about reusage of threads
-#pragma omp parallel for num_threads(Params.numthreads) \
-            default(none) shared(width, temp, sums) private(i)
-            for (i = 0; i < width * width; i++) {
+// what the engines measured, summed over the processes
+static void reportStats(int myid, const struct engine *engine, struct engineStats *stats){
+    long long sums[4] = {stats->cells, stats->tiles, stats->computed_tiles, stats->bytes};
 
-                if (!isOuter(i, width)) {
+    MPI_Reduce(I_AM_MASTER(myid) ? MPI_IN_PLACE : sums, sums, 4, MPI_LONG_LONG, MPI_SUM, MASTER_PROC_ID, MPI_COMM_WORLD);
+    if (!I_AM_MASTER(myid)) return;
 
-                    sums[i] = countNeighboursInner(i, temp, width);
-                }
-            }
-        }else{
+    if (sums[1] > 0) printf("Computed %.1f%% of the tiles.\n", 100.0 * sums[2] / sums[1]);
+    printf("The %s engine computed %lld cells in %lld generations, its boards take %.1f MB.\n", engine->name, sums[0],
+           stats->generations, sums[3] / 1e6);
+}
 
-#pragma omp parallel for \
-            default(none) shared(width, temp, sums) private(i)
-            for (i = 0; i < width * width; i++) {
 
-                if (!isOuter(i, width)) {
+// the master receives the other subboards into the same buffers every generation, its own is passed along
+static int ***allocatePrintBuffers(int myid){
+    int ***in, i, j;
 
-                    sums[i] = countNeighboursInner(i, temp, width);
-                }
-            }
+    if (!I_AM_MASTER(myid) || !Params.should_print) return NULL;
 
+    in = malloc(sizeof(int **) * Grid.dims[0]);
+    for (i = 0; i < Grid.dims[0]; i++) {
+        in[i] = malloc(sizeof(int *) * Grid.dims[1]);
+        for (j = 0; j < Grid.dims[1]; j++) {
+            in[i][j] = (i == 0 && j == 0) ? NULL : malloc(sizeof(int) * blockRows(i) * blockCols(j));
         }
+    }
+    return in;
+}
+
+static void freePrintBuffers(int ***in){
+    int i, j;
 
+    if (in == NULL) return;
+    for (i = 0; i < Grid.dims[0]; i++) {
+        for (j = 0; j < Grid.dims[1]; j++) if (i != 0 || j != 0) free(in[i][j]);
+        free(in[i]);
+    }
+    free(in);
+}
 
-        finalizeCommunications(
-                &sHandlerUp, &sHandlerDown, &sHandlerLeft, &sHandlerRight, &sHandlerUpLeft, &sHandlerRight, &sHandlerDownLeft, &sHandlerRight,
-                &rHandlerUp, &rHandlerDown, &rHandlerLeft, &rHandlerRight, &rHandlerUpLeft, &rHandlerRight, &rHandlerDownLeft, &rHandlerRight);
 
 
+int main(int argc, char **argv)
+{
+    int myid, numprocs, provided;
+    int numIterations, last, timed;
+    double load;
+    double start_t;
+    int *** in;
+    int *board;                       // as ints, until the engine has it
+    void *cells;                      // in the engine of the game
+    long long generation = 0;         // of the board the game starts from
+    const char *isa;
+    const struct engine *engine;
+    struct cycleDetector cycle;       // over all the epochs
+    struct engineStats stats = {0, 0, 0, 0, 0};
 
-        for(i=0;i<width*width;i++) {
+    // the game loops call MPI from the master thread of their team only
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
 
-            if (isOuter(i, width)) {
-                sums[i] = countNeighboursOuter(i, temp, width,
-                                               up_buffer, down_buffer, left_buffer, right_buffer,
-                                               up_left_buffer, up_right_buffer,
-                                               down_left_buffer, down_right_buffer);
-            }
+
+    MPI_Comm_size(MPI_COMM_WORLD,&numprocs);
+    MPI_Comm_rank(MPI_COMM_WORLD, &myid);
+
+    if (provided < MPI_THREAD_FUNNELED && I_AM_MASTER(myid)) fprintf(stderr, "Warning: this MPI library does not support threads calling it from a parallel region.\n");
+
+    parseCommandLineArguments(argc, argv);
+    if (Params.restart_file != NULL) generation = readCheckpointHeader(Params.restart_file);
+
+#ifdef _OPENMP
+    if (Params.numthreads != -1) omp_set_num_threads(Params.numthreads);
+#endif
+
+    if (Params.bind_threads) {
+        switch (bindThreads()) {
+            case 0:  if (I_AM_MASTER(myid)) fprintf(stderr, "Could not bind the threads to cores, they are left free.\n"); break;
+            case 1:  if (I_AM_MASTER(myid)) printf("Bound every thread to its own core.\n"); break;
+            default: if (I_AM_MASTER(myid)) printf("Bound the threads to cores, some of them sharing a core.\n"); break;
         }
+    }
+
+    // a seed that was not given comes from the master's clock, and is shown so that the run can be repeated
+    if (!Params.seed_given) {
+        Params.seed = (unsigned long long) time(NULL);
+        MPI_Bcast(&Params.seed, 1, MPI_UNSIGNED_LONG_LONG, MASTER_PROC_ID, MPI_COMM_WORLD);
+    }
+    if (I_AM_MASTER(myid)) printf("Using seed %llu.\n", Params.seed);
+
+    // the boards of an ensemble are whole boards of each process, there is no grid
+    if (Params.ensemble > 0) {
+        if (Params.restart_file != NULL || Params.pattern_file != NULL || Params.hashlife_generations > 0 || Params.hashlife_check) {
+            if (I_AM_MASTER(myid)) fprintf(stderr, "The boards of an ensemble are drawn, they cannot start from a checkpoint, pattern or HashLife.\n");
+            MPI_Finalize();
+            return 1;
+        }
+        playEnsemble();
+        MPI_Finalize();
+        return 0;
+    }
+
+
+    setupGrid(numprocs);
+
 
+    in = allocatePrintBuffers(myid);
 
-        myChange = updateLocalState(sums, temp, width);
 
-        //todo: documentation here
-        if (numIterations % 10 == 0) {
-            someChangeHappened = checkGlobalStateChanged(myChange);
-        }else{
-            someChangeHappened = 1;
+    if (Params.kernel == KERNEL_TILED && Params.halo_depth != 1) {
+        if (I_AM_MASTER(myid)) fprintf(stderr, "The tiled kernel keeps a single ghost cell, it cannot be combined with a deeper halo.\n");
+        MPI_Finalize();
+        return 1;
+    }
+
+    if (Params.kernel == KERNEL_FLAT && (numprocs != 1 || Params.halo_depth != 1)) {
+        if (I_AM_MASTER(myid)) fprintf(stderr, "The flat kernel plays the whole board as a torus on one process, without ghost cells.\n");
+        MPI_Finalize();
+        return 1;
+    }
+
+    if (Params.balance_every > 0 && !PHASE_TIMERS) {
+        if (I_AM_MASTER(myid)) fprintf(stderr, "The load balancing measures the work with the phase timers, this build has none (TIMERS=0).\n");
+        MPI_Finalize();
+        return 1;
+    }
+
+    if (Params.neighbourhood && (Params.shared_memory || Params.kernel == KERNEL_PACKED || Params.kernel == KERNEL_TILED || Params.kernel == KERNEL_FLAT)) {
+        if (I_AM_MASTER(myid)) fprintf(stderr, "The neighbourhood collective halos are for the int and simd kernels, without shared memory.\n");
+        MPI_Finalize();
+        return 1;
+    }
+
+    if (Params.shared_memory && (Params.kernel == KERNEL_PACKED || Params.kernel == KERNEL_TILED || Params.kernel == KERNEL_FLAT)) {
+        if (I_AM_MASTER(myid)) fprintf(stderr, "The shared memory halos are for the int and simd kernels only.\n");
+        MPI_Finalize();
+        return 1;
+    }
+
+    if (Params.kernel == KERNEL_SIMD || Params.kernel == KERNEL_TILED) {
+        isa = selectSimdKernel(Params.isa);
+        if (isa == NULL) {
+            if (I_AM_MASTER(myid)) fprintf(stderr, "The requested instruction set is not supported by this cpu.\n");
+            MPI_Finalize();
+            return 1;
         }
+        if (I_AM_MASTER(myid)) printf("Using the %s simd kernel.\n", isa);
+    }
 
 
-    }// end of game loop
+    board = allocateBoard(sizeof(int) * (size_t) Grid.rows * Grid.cols);
+    if (Params.restart_file != NULL) {
+        readCheckpoint(Params.restart_file, board);
+    } else if (Params.pattern_file != NULL) {
+        loadPattern(Params.pattern_file, board);
+    } else {
+        initializeBoard(board, Grid.rows, Grid.cols, Grid.row0, Grid.col0, Params.alive_probability, Params.seed);
+    }
+
+    if (I_AM_MASTER(myid)) printf("Playing %s.\n", Rule.name);
 
+    if (Params.hashlife_generations > 0 || Params.hashlife_check) {
+        hashlifeForward(board, Params.hashlife_generations);
+        generation += Params.hashlife_generations;
+    }
+    setupCheckpoints(generation);
+    setupSnapshots(generation);
+    if (snapshotDue(0)) writeSnapshot(intSubboard(board), 0);
+    setupTimers();
+
+
+    // with --balance the game is played in epochs, between which the blocks may move
+    setupCycleDetector(&cycle, Params.max_period);
+    engine = kernelEngine(Params.kernel);
+    cells  = load_board(engine, board);
+    numIterations = 0;
+    do {
+        last = Params.max_iterations;
+        if (Params.balance_every > 0 && (last == -1 || numIterations + Params.balance_every < last)) last = numIterations + Params.balance_every;
+        load = computeSeconds();
+
+        numIterations = playGame(engine, cells, myid, numprocs, in, numIterations, last, &cycle, &start_t);
+
+        if (gameOver || numIterations == Params.max_iterations) break;
+        if (rebalanceCuts(computeSeconds() - load)) {
+            board = unload_board(engine, cells, &stats);
+            moveBlocks(&board);
+            cells = load_board(engine, board);
+
+            freePrintBuffers(in);
+            in = allocatePrintBuffers(myid);
+            clearCycleHistory(&cycle);
+        }
+    } while (1);
+    freeCycleDetector(&cycle);
+
+    // the HashLife check is the only one to need the final board as ints
+    if (Params.hashlife_check) {
+        board = unload_board(engine, cells, &stats);
+    } else {
+        engine->stats(cells, &stats);
+        engine->free(cells);
+    }
+    reportStats(myid, engine, &stats);
+
+    finishSnapshots();
     MPI_Barrier(MPI_COMM_WORLD);
     double end_t = MPI_Wtime();
 
@@ -163,9 +433,24 @@ int main(int argc, char **argv)
     MPI_Allreduce(&time_diff, &max_diff, 1, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
     MPI_Allreduce(&time_diff, &min_diff, 1, MPI_DOUBLE, MPI_MIN, MPI_COMM_WORLD);
 
-    if (I_AM_MASTER(myid)) printf("Elapsed time (%d iterations): %f sec (max)\n", numIterations, max_diff);
-    if (I_AM_MASTER(myid)) printf("Elapsed time (%d iterations): %f sec (master time)\n", numIterations, time_diff);
-    if (I_AM_MASTER(myid)) printf("Elapsed time (%d iterations): %f sec (min)\n", numIterations, min_diff);
+    // the warm-up is not timed, unless the game ended during it
+    timed = (numIterations > Params.warmup_generations) ? numIterations - Params.warmup_generations : numIterations;
+
+    if (I_AM_MASTER(myid)) printf("Elapsed time (%d iterations): %f sec (max)\n", timed, max_diff);
+    if (I_AM_MASTER(myid)) printf("Elapsed time (%d iterations): %f sec (master time)\n", timed, time_diff);
+    if (I_AM_MASTER(myid)) printf("Elapsed time (%d iterations): %f sec (min)\n", timed, min_diff);
+    reportTimers();
+    if (Params.report_file != NULL) writeReport(Params.report_file, timed, max_diff);
+
+    if (Params.hashlife_check) {
+        if (hashlifeCheck(board, numIterations)) {
+            if (I_AM_MASTER(myid)) printf("HashLife check: the final board matches.\n");
+        } else {
+            if (I_AM_MASTER(myid)) printf("HashLife check: the final board DIFFERS.\n");
+        }
+        freeBoard(board, sizeof(int) * (size_t) Grid.rows * Grid.cols);
+    }
+    freePrintBuffers(in);
 
     MPI_Finalize();
     return 0;
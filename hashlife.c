@@ -0,0 +1,455 @@
+#include <stdlib.h>  /* for malloc/free */
+#include <string.h>
+#include <stdint.h>
+
+#include "lib.h"
+#include "hashlife.h"
+
+
+// A square of 2^level cells on a side. The two leaves (level 0) are the dead and the alive cell,
+// every other node is unique for its four quadrants.
+struct node{
+    struct node *nw, *ne, *sw, *se;
+    struct node *result;              // centre square 2^result_step generations later, NULL if not computed yet
+    struct node *chain;               // next node of the same hash bucket, or of the free list
+    int level;                        // -1 for a free node of the pool
+    int result_step;
+    int mark;                         // reachable from a root, while collecting
+};
+
+static struct node leaves[2] = {
+    {NULL, NULL, NULL, NULL, NULL, NULL, 0, 0, 1},
+    {NULL, NULL, NULL, NULL, NULL, NULL, 0, 0, 1}
+};
+
+static struct node *pool = NULL, *free_list = NULL, **buckets = NULL;
+static size_t capacity, used, bucket_mask;
+
+static struct node *saved_root = NULL;    // board of the last hashlifeForward, master only
+static int side_level;                    // the board, tiled if it is not square, is 2^side_level cells on a side
+
+
+static const char cache_too_small[] = "The HashLife node cache is too small for this board, use a larger --hashlife-memory.\n";
+
+
+// whether the pool could be allocated
+static int setup_pool(void){
+    size_t i, bytes = (size_t) Params.hashlife_memory << 20, nbuckets = 1;
+
+    if (pool != NULL) return 1;
+
+    // a bucket per node at most, in a power-of-two table
+    capacity = bytes / (sizeof(struct node) + 2 * sizeof(struct node *));
+    while (nbuckets < capacity) nbuckets *= 2;
+    bucket_mask = nbuckets - 1;
+
+    pool    = malloc(capacity * sizeof(struct node));
+    buckets = calloc(nbuckets, sizeof(struct node *));
+    if (pool == NULL || buckets == NULL){
+        free(pool);
+        free(buckets);
+        pool = NULL;
+        buckets = NULL;
+        return 0;
+    }
+
+    for (i = 0; i < capacity; i++){
+        pool[i].level = -1;
+        pool[i].chain = free_list;
+        free_list = &pool[i];
+    }
+    used = 0;
+    return 1;
+}
+
+
+static size_t node_hash(const struct node *nw, const struct node *ne, const struct node *sw, const struct node *se){
+    uint64_t h = (uintptr_t) nw;
+
+    h = h * 0x9E3779B97F4A7C15ULL + (uintptr_t) ne;
+    h = h * 0x9E3779B97F4A7C15ULL + (uintptr_t) sw;
+    h = h * 0x9E3779B97F4A7C15ULL + (uintptr_t) se;
+    return (size_t) (h ^ (h >> 29));
+}
+
+static void insert_node(struct node *n){
+    size_t b = node_hash(n->nw, n->ne, n->sw, n->se) & bucket_mask;
+
+    n->chain   = buckets[b];
+    buckets[b] = n;
+}
+
+// The node with the given quadrants. NULL if the pool is full, or if one of the quadrants is NULL already,
+// so that a failure travels up through the recursion.
+static struct node *join(struct node *nw, struct node *ne, struct node *sw, struct node *se){
+    size_t b;
+    struct node *n;
+
+    if (nw == NULL || ne == NULL || sw == NULL || se == NULL) return NULL;
+
+    b = node_hash(nw, ne, sw, se) & bucket_mask;
+    for (n = buckets[b]; n != NULL; n = n->chain){
+        if (n->nw == nw && n->ne == ne && n->sw == sw && n->se == se) return n;
+    }
+
+    if (free_list == NULL) return NULL;
+    n = free_list;
+    free_list = n->chain;
+
+    n->nw = nw; n->ne = ne; n->sw = sw; n->se = se;
+    n->level  = nw->level + 1;
+    n->result = NULL;
+    n->mark   = 0;
+    insert_node(n);
+    used++;
+    return n;
+}
+
+
+static void mark_node(struct node *n){
+    if (n->mark) return;          // the leaves are always marked
+    n->mark = 1;
+    mark_node(n->nw);
+    mark_node(n->ne);
+    mark_node(n->sw);
+    mark_node(n->se);
+}
+
+// Keep the nodes reachable from the roots and free the rest. Memoized results are kept when their node survives.
+static void collect(struct node **roots, int nroots){
+    size_t i;
+    struct node *n;
+
+    for (i = 0; i < capacity; i++) pool[i].mark = 0;
+    for (i = 0; i < (size_t) nroots; i++){
+        if (roots[i] != NULL) mark_node(roots[i]);
+    }
+
+    memset(buckets, 0, (bucket_mask + 1) * sizeof(struct node *));
+    free_list = NULL;
+    used = 0;
+
+    for (i = 0; i < capacity; i++){
+        n = &pool[i];
+        if (n->level > 0 && n->mark){
+            if (n->result != NULL && !n->result->mark) n->result = NULL;
+            insert_node(n);
+            used++;
+        }else{
+            n->level  = -1;
+            n->chain  = free_list;
+            free_list = n;
+        }
+    }
+}
+
+
+// cell (r, c), 0 <= r, c < 2, of a level 1 node
+static int leaf_alive(const struct node *n, int r, int c){
+    const struct node *q = r ? (c ? n->se : n->sw) : (c ? n->ne : n->nw);
+    return q == &leaves[1];
+}
+
+// Centre 2x2 cells of a 4x4 node one generation later
+static struct node *evolve_block(struct node *n){
+    int g[4][4], next[2][2], r, c, i, j, sum;
+
+    for (r = 0; r < 4; r++){
+        for (c = 0; c < 4; c++){
+            struct node *q = r < 2 ? (c < 2 ? n->nw : n->ne) : (c < 2 ? n->sw : n->se);
+            g[r][c] = leaf_alive(q, r % 2, c % 2);
+        }
+    }
+
+    for (r = 1; r <= 2; r++){
+        for (c = 1; c <= 2; c++){
+            sum = 0;
+            for (i = -1; i <= 1; i++){
+                for (j = -1; j <= 1; j++) sum += g[r+i][c+j];
+            }
+            sum -= g[r][c];
+            next[r-1][c-1] = Rule.next[g[r][c]][sum];
+        }
+    }
+
+    return join(&leaves[next[0][0]], &leaves[next[0][1]], &leaves[next[1][0]], &leaves[next[1][1]]);
+}
+
+static struct node *centre(struct node *n){
+    return join(n->nw->se, n->ne->sw, n->sw->ne, n->se->nw);
+}
+
+// Centre of a level n node (a square of half its side) 2^step generations later, step <= n-2.
+// The node is cut in nine overlapping squares of half its side; with the longest step each of them is advanced
+// by half the step, otherwise they are only cropped, and the four squares they form are advanced by the rest.
+static struct node *successor(struct node *n, int step){
+    struct node *s[3][3], *a[3][3], *q[4], *result;
+    int i, j, full, rest;
+
+    if (n == NULL) return NULL;
+    full = (step == n->level - 2);
+    rest = full ? step - 1 : step;
+    if (n->result != NULL && n->result_step == step) return n->result;
+
+    if (n->level == 2){
+        result = evolve_block(n);
+    }else{
+        s[0][0] = n->nw;
+        s[0][1] = join(n->nw->ne, n->ne->nw, n->nw->se, n->ne->sw);
+        s[0][2] = n->ne;
+        s[1][0] = join(n->nw->sw, n->nw->se, n->sw->nw, n->sw->ne);
+        s[1][1] = join(n->nw->se, n->ne->sw, n->sw->ne, n->se->nw);
+        s[1][2] = join(n->ne->sw, n->ne->se, n->se->nw, n->se->ne);
+        s[2][0] = n->sw;
+        s[2][1] = join(n->sw->ne, n->se->nw, n->sw->se, n->se->sw);
+        s[2][2] = n->se;
+
+        for (i = 0; i < 3; i++){
+            for (j = 0; j < 3; j++){
+                if (s[i][j] == NULL) return NULL;
+                a[i][j] = full ? successor(s[i][j], n->level - 3) : centre(s[i][j]);
+                if (a[i][j] == NULL) return NULL;
+            }
+        }
+
+        for (i = 0; i < 4; i++){
+            q[i] = successor(join(a[i/2][i%2], a[i/2][i%2+1], a[i/2+1][i%2], a[i/2+1][i%2+1]), rest);
+        }
+        result = join(q[0], q[1], q[2], q[3]);
+    }
+    if (result == NULL) return NULL;
+
+    n->result      = result;
+    n->result_step = step;
+    return result;
+}
+
+
+// The 2^level square at (r, c) of the board tiled over the plane
+static struct node *build(const uint8_t *board, int level, long r, long c){
+    long half;
+
+    if (level == 0) return &leaves[board[(r % Params.Rows) * Params.Cols + c % Params.Cols]];
+
+    half = 1L << (level - 1);
+    return join(build(board, level - 1, r,        c),
+                build(board, level - 1, r,        c + half),
+                build(board, level - 1, r + half, c),
+                build(board, level - 1, r + half, c + half));
+}
+
+static void read_back(const struct node *n, uint8_t *board, long r, long c){
+    long half;
+
+    if (r >= Params.Rows || c >= Params.Cols) return;   // a copy of the tiled board
+    if (n->level == 0){
+        board[r * Params.Cols + c] = (n == &leaves[1]);
+        return;
+    }
+
+    half = 1L << (n->level - 1);
+    read_back(n->nw, board, r,        c);
+    read_back(n->ne, board, r,        c + half);
+    read_back(n->sw, board, r + half, c);
+    read_back(n->se, board, r + half, c + half);
+}
+
+
+// The board root 2^step generations later. The board is tiled in a square node big enough for the step, its
+// result is a window of the tiled plane: aligned with the board when the step is a multiple of the side, moved
+// by half a side in both directions otherwise, which swapping the quadrants undoes.
+static struct node *advance_pow2(struct node *root, int step){
+    struct node *tiled = root, *r;
+    int level = (step + 2 > side_level + 1) ? step + 2 : side_level + 1;
+
+    while (tiled != NULL && tiled->level < level) tiled = join(tiled, tiled, tiled, tiled);
+
+    r = successor(tiled, step);
+    if (r == NULL) return NULL;
+
+    if (level == side_level + 1) return join(r->se, r->sw, r->ne, r->nw);
+    while (r->level > side_level) r = r->nw;
+    return r;
+}
+
+// Same, collecting the pool when it is full and splitting the step when even that is not enough
+static struct node *advance(struct node *root, int step){
+    struct node *r;
+
+    if (used > capacity / 4 * 3) collect(&root, 1);
+
+    r = advance_pow2(root, step);
+    if (r != NULL) return r;
+
+    collect(&root, 1);
+    r = advance_pow2(root, step);
+    if (r != NULL || step == 0) return r;
+
+    r = advance(root, step - 1);
+    return r == NULL ? NULL : advance(r, step - 1);
+}
+
+// NULL when the pool is too small even for single steps
+static struct node *advance_by(struct node *root, long long generations){
+    int step;
+
+    for (step = 0; step < 63 && root != NULL && (generations >> step) != 0; step++){
+        if ((generations >> step) & 1) root = advance(root, step);
+    }
+    return root;
+}
+
+
+int hashlifeSupported(void){
+    int side = Params.Rows > Params.Cols ? Params.Rows : Params.Cols;
+
+    return side >= 2 && (Params.Rows & (Params.Rows - 1)) == 0 && (Params.Cols & (Params.Cols - 1)) == 0;
+}
+
+
+// where the subboard of every process starts in the gathered buffer, which holds them one after the other
+static void block_layout(int *counts, int *displs){
+    int i, numprocs, coords[2];
+
+    MPI_Comm_size(Grid.comm, &numprocs);
+    for (i = 0; i < numprocs; i++){
+        MPI_Cart_coords(Grid.comm, i, 2, coords);
+        counts[i] = blockRows(coords[0]) * blockCols(coords[1]);
+        displs[i] = i == 0 ? 0 : displs[i-1] + counts[i-1];
+    }
+}
+
+// Copy between the whole board and the gathered buffer, in the direction given by to_board
+static void arrange_blocks(uint8_t *board, uint8_t *blocks, const int *displs, int to_board){
+    int i, r, numprocs, coords[2], rows, cols, row0, col0;
+    uint8_t *cell, *block;
+
+    MPI_Comm_size(Grid.comm, &numprocs);
+    for (i = 0; i < numprocs; i++){
+        MPI_Cart_coords(Grid.comm, i, 2, coords);
+        rows = blockRows(coords[0]);
+        cols = blockCols(coords[1]);
+        row0 = blockRow0(coords[0]);
+        col0 = blockCol0(coords[1]);
+
+        for (r = 0; r < rows; r++){
+            cell  = board + (size_t) (row0 + r) * Params.Cols + col0;
+            block = blocks + displs[i] + (size_t) r * cols;
+            if (to_board) memcpy(cell, block, cols);
+            else          memcpy(block, cell, cols);
+        }
+    }
+}
+
+// The whole board on the master, one byte per cell (NULL on the other processes)
+static uint8_t *gather_board(const int *block){
+    int i, myid, numprocs, size = Grid.rows * Grid.cols;
+    int *counts = NULL, *displs = NULL;
+    uint8_t *mine = malloc(size), *blocks = NULL, *board = NULL;
+
+    MPI_Comm_rank(Grid.comm, &myid);
+    MPI_Comm_size(Grid.comm, &numprocs);
+    for (i = 0; i < size; i++) mine[i] = (uint8_t) block[i];
+
+    if (I_AM_MASTER(myid)){
+        counts = malloc(sizeof(int) * numprocs);
+        displs = malloc(sizeof(int) * numprocs);
+        block_layout(counts, displs);
+        blocks = malloc((size_t) Params.Rows * Params.Cols);
+        board  = malloc((size_t) Params.Rows * Params.Cols);
+    }
+
+    MPI_Gatherv(mine, size, MPI_UINT8_T, blocks, counts, displs, MPI_UINT8_T, MASTER_PROC_ID, Grid.comm);
+    if (I_AM_MASTER(myid)) arrange_blocks(board, blocks, displs, 1);
+
+    free(mine);
+    free(blocks);
+    free(counts);
+    free(displs);
+    return board;
+}
+
+static void scatter_board(uint8_t *board, int *block){
+    int i, myid, numprocs, size = Grid.rows * Grid.cols;
+    int *counts = NULL, *displs = NULL;
+    uint8_t *mine = malloc(size), *blocks = NULL;
+
+    MPI_Comm_rank(Grid.comm, &myid);
+    MPI_Comm_size(Grid.comm, &numprocs);
+
+    if (I_AM_MASTER(myid)){
+        counts = malloc(sizeof(int) * numprocs);
+        displs = malloc(sizeof(int) * numprocs);
+        block_layout(counts, displs);
+        blocks = malloc((size_t) Params.Rows * Params.Cols);
+        arrange_blocks(board, blocks, displs, 0);
+    }
+
+    MPI_Scatterv(blocks, counts, displs, MPI_UINT8_T, mine, size, MPI_UINT8_T, MASTER_PROC_ID, Grid.comm);
+    for (i = 0; i < size; i++) block[i] = mine[i];
+
+    free(mine);
+    free(blocks);
+    free(counts);
+    free(displs);
+}
+
+
+// the errors are found on the master, all processes leave together
+void hashlifeForward(int *block, long long generations){
+    int myid, failed, side = Params.Rows > Params.Cols ? Params.Rows : Params.Cols;
+    uint8_t *board = gather_board(block);
+    struct node *root;
+    const char *error = NULL;
+    double start_t;
+
+    MPI_Comm_rank(Grid.comm, &myid);
+    if (I_AM_MASTER(myid)){
+        if (!setup_pool()) error = "Could not allocate the HashLife node cache.\n";
+        for (side_level = 0; (1 << side_level) < side; side_level++);
+
+        if (error == NULL){
+            collect(NULL, 0);   // a new board, nothing of the old one is kept
+            root = build(board, side_level, 0, 0);
+
+            start_t = MPI_Wtime();
+            saved_root = root = (root != NULL) ? advance_by(root, generations) : NULL;
+            if (root == NULL) error = cache_too_small;
+        }
+        if (error == NULL){
+            read_back(root, board, 0, 0);
+            printf("HashLife: %lld generations in %f sec, %zu of %zu nodes in use.\n", generations, MPI_Wtime() - start_t, used, capacity);
+        }
+    }
+
+    failed = (error != NULL);
+    MPI_Bcast(&failed, 1, MPI_INT, MASTER_PROC_ID, Grid.comm);
+    if (failed) collectiveError(error);
+
+    scatter_board(board, block);
+    free(board);
+}
+
+
+int hashlifeCheck(const int *block, long long generations){
+    int myid, answer[2] = {0, 0};    // whether the boards are the same, whether the cache was too small
+    uint8_t *board = gather_board(block);
+    struct node *root, *stencil = NULL;
+
+    MPI_Comm_rank(Grid.comm, &myid);
+    if (I_AM_MASTER(myid)){
+        root = advance_by(saved_root, generations);
+        if (root != NULL){
+            collect(&root, 1);
+            stencil = build(board, side_level, 0, 0);
+        }
+        answer[0] = (stencil != NULL && stencil == root);   // equal boards are the same node
+        answer[1] = (stencil == NULL);
+        saved_root = root;
+    }
+
+    free(board);
+    MPI_Bcast(answer, 2, MPI_INT, MASTER_PROC_ID, Grid.comm);
+    if (answer[1]) collectiveError(cache_too_small);
+    return answer[0];
+}
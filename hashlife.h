@@ -0,0 +1,26 @@
+#ifndef _HASHLIFE_H_
+#define _HASHLIFE_H_
+
+#include "lib.h"
+
+
+// HashLife: the board is a quadtree of hash-consed nodes (equal squares are the same node), and every node
+// memoizes its centre 2^k generations later, so repeated patterns in space and time are only computed once.
+// The torus is followed exactly by tiling it over the plane, which needs power-of-two board sides.
+//
+// The nodes live in a pool of --hashlife-memory megabytes; when it fills up the nodes the board no longer
+// uses are collected, and a jump that still does not fit is split into two of half the length.
+
+int hashlifeSupported(void);                                 // whether the board has the shape HashLife needs
+
+// Collective. Every process passes its own subboard (Grid.rows x Grid.cols ints, row-major), the whole board is
+// advanced by the given number of generations on the master and handed back in the same blocks. The result is
+// remembered for hashlifeCheck.
+void hashlifeForward(int *block, long long generations);
+
+// Collective. Whether the subboards hold the board of the last hashlifeForward advanced by the given number
+// of generations (the answer is only valid on the master).
+int hashlifeCheck(const int *block, long long generations);
+
+
+#endif
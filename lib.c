@@ -1,12 +1,22 @@
 #include <assert.h>  /* for assert */
-#include <math.h>    /* for sqrt */
 #include <stdlib.h>  /* for malloc/free */
 #include <getopt.h>
 #include <unistd.h>
 #include <ctype.h>
 #include <string.h>
+#include <stdarg.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 #include "lib.h"
+#include "hashlife.h"
+#include "timing.h"
+#include "engine.h"
+
+struct params Params;
+struct rule Rule;
 
 /// deleteme
 #include "mpi.h"
@@ -25,6 +35,7 @@ int I_AM_SLAVE(int myid) {
 void parseCommandLineArguments(int argc, char* argv[]){
 
     int c;
+    char *at;
     opterr = 0; /* defined in unitstd.h */
 
 
@@ -32,21 +43,81 @@ void parseCommandLineArguments(int argc, char* argv[]){
      * REQUIRED:
      * -r X: Use table of X rows.
      * -c X: Use table of X columns.
+     * (or -s X: Use table of X rows and X columns.)
      *
      * OPTIONAL:
+     * -g PxQ: Split the table over a grid of P x Q processes (default: chosen by MPI).
      * -t X: Execute with X threads (if possible) (Use -1 for maximum number possible - Default).
      * -a X: Use X (in %) as probability of spawning an alive creature at each cells in the initial state. (default 15)
      * -s X: Stop the game after X generations. (default 100) (Use -1 for infinite)
+     * -k X: Compute generations with kernel X ("int" - Default, "packed", "simd", "tiled" or "flat"), also --engine X.
+     * -i X: Use instruction set X in the simd and tiled kernels ("scalar", "sse2", "avx2", "avx512") (default: best available).
+     * -d X: Keep X ghost cells around each subboard and exchange them every X generations. (default 1)
+     * -H X: Fast-forward the initial board by X generations with HashLife (board sides must be powers of two).
+     * -M X: Give HashLife X megabytes of nodes. (default 512)
+     * -C  : Check the final board against HashLife.
+     * -y X: Stop as soon as the board repeats itself with a period of at most X generations.
+     * -S X: Draw the initial board from seed X. (default: the time)
+     * -K X: Write a checkpoint every X generations. (default: never)
+     * -F X: Write the checkpoints to file X. (default game.ckpt)
+     * -R X: Restart from checkpoint X, which also sets the size of the board.
+     * -P X: Start from the pattern of file X (RLE or Life 1.06), at column x and row y with X@x,y.
+     * -n X: Write a PBM image of the board every X generations. (default: never)
+     * -o X: Name the images X followed by the generation. (default frame)
+     * -v X: Also print the board shrunk X times on each side with every image.
+     * -w X: Do not time the first X generations. (default 0)
+     * -j X: Append the measures of the run to file X, as CSV or as JSON if X ends in .json.
+     * -T X: Write the phases of every process to file X as a Chrome trace.
+     * -B X: Play the Life-like rule X, like B36/S23. (default B3/S23)
+     * -b  : Bind every thread to its own core.
+     * -m  : Read the edges of the neighbours on the same node from their boards, in shared memory.
+     * -L X: Measure the work of every process every X generations and move the blocks to even it out. (default: never)
+     * -I X: Move them when the busiest process works X% more than the mean. (default 10)
+     * -N  : Exchange the halos with neighbourhood collectives.
+     * -E X: Play X seeds of every probability of -a (which may be a range A:B) as independent boards.
+     * -X X: Write the results of the boards of the ensemble to file X. (default ensemble.csv)
      * -p  : Print each state on screen.
      * -h  : Display help message.
      */
 
     Params.Cols              = -1;
     Params.Rows              = -1;
+    Params.proc_rows         = 0;
+    Params.proc_cols         = 0;
     Params.numthreads        = -1;
     Params.alive_probability = 15;
+    Params.alive_probability_to = 15;
     Params.max_iterations    = 100;
-
+    Params.kernel            = KERNEL_INT;
+    Params.isa               = ISA_AUTO;
+    Params.halo_depth        = 1;
+    Params.hashlife_generations = 0;
+    Params.hashlife_memory   = 512;
+    Params.hashlife_check    = 0;
+    Params.max_period        = 0;
+    Params.seed              = 0;
+    Params.seed_given        = 0;
+    Params.checkpoint_every  = 0;
+    Params.checkpoint_file   = "game.ckpt";
+    Params.restart_file      = NULL;
+    Params.pattern_file      = NULL;
+    Params.pattern_col       = 0;
+    Params.pattern_row       = 0;
+    Params.snapshot_every    = 0;
+    Params.warmup_generations = 0;
+    Params.report_file       = NULL;
+    Params.trace_file        = NULL;
+    Params.rule_given        = 0;
+    parseRule("B3/S23", &Rule);
+    Params.snapshot_file     = "frame";
+    Params.preview_factor    = 0;
+    Params.bind_threads      = 0;
+    Params.shared_memory     = 0;
+    Params.balance_every     = 0;
+    Params.imbalance         = 10;
+    Params.ensemble          = 0;
+    Params.neighbourhood     = 0;
+    Params.ensemble_file     = "ensemble.csv";
 
 
     static int print_flag = 0;
@@ -55,9 +126,39 @@ void parseCommandLineArguments(int argc, char* argv[]){
     static struct option long_options[] =
             {
                     {"size",       required_argument, 0,           's'},
+                    {"rows",       required_argument, 0,           'r'},
+                    {"cols",       required_argument, 0,           'c'},
+                    {"grid",       required_argument, 0,           'g'},
                     {"threads",    required_argument, 0,           't'},
                     {"alive-prob", required_argument, 0,           'a'},
                     {"end",        required_argument, 0,           'e'},
+                    {"kernel",     required_argument, 0,           'k'},
+                    {"engine",     required_argument, 0,           'k'},
+                    {"isa",        required_argument, 0,           'i'},
+                    {"halo-depth", required_argument, 0,           'd'},
+                    {"hashlife",   required_argument, 0,           'H'},
+                    {"hashlife-memory", required_argument, 0,      'M'},
+                    {"hashlife-check", no_argument,   0,           'C'},
+                    {"cycle",      required_argument, 0,           'y'},
+                    {"seed",       required_argument, 0,           'S'},
+                    {"checkpoint-every", required_argument, 0,     'K'},
+                    {"checkpoint-file",  required_argument, 0,     'F'},
+                    {"restart",    required_argument, 0,           'R'},
+                    {"pattern",    required_argument, 0,           'P'},
+                    {"snapshot-every", required_argument, 0,       'n'},
+                    {"snapshot-file",  required_argument, 0,       'o'},
+                    {"preview",    required_argument, 0,           'v'},
+                    {"warmup",     required_argument, 0,           'w'},
+                    {"report",     required_argument, 0,           'j'},
+                    {"trace",      required_argument, 0,           'T'},
+                    {"rule",       required_argument, 0,           'B'},
+                    {"bind",       no_argument,       0,           'b'},
+                    {"shared-memory", no_argument,    0,           'm'},
+                    {"balance",    required_argument, 0,           'L'},
+                    {"imbalance",  required_argument, 0,           'I'},
+                    {"ensemble",   required_argument, 0,           'E'},
+                    {"neighbourhood", no_argument,    0,           'N'},
+                    {"ensemble-file", required_argument, 0,        'X'},
                     {"print",      no_argument,       &print_flag, 'p'},
                     {"help",       no_argument,       &help_flag,  'h'},
                     {0, 0, 0, 0}
@@ -65,7 +166,7 @@ void parseCommandLineArguments(int argc, char* argv[]){
 
     int option_index = 0;
 
-    while ((c = getopt_long(argc, argv, "s:t:a:e:ph", long_options, &option_index)) != -1)
+    while ((c = getopt_long(argc, argv, "s:r:c:g:t:a:e:k:i:d:H:M:Cy:S:K:F:R:P:n:o:v:w:j:T:B:bmNL:I:E:X:ph", long_options, &option_index)) != -1)
         switch (c)
         {
             case 's':
@@ -74,26 +175,200 @@ void parseCommandLineArguments(int argc, char* argv[]){
 
                 break;
 
+            case 'r':
+                Params.Rows = atoi(optarg);
+                break;
+
+            case 'c':
+                Params.Cols = atoi(optarg);
+                break;
+
+            case 'g':
+                if (sscanf(optarg, "%dx%d", &Params.proc_rows, &Params.proc_cols) != 2 || Params.proc_rows < 1 || Params.proc_cols < 1){
+                    fprintf(stderr, "Option -g expects a grid like 4x12, not `%s'.\n", optarg);
+                    exit(1);
+                }
+                break;
+
             case 't':
                 Params.numthreads = atoi(optarg);
                 break;
 
             case 'a':
-                Params.alive_probability = atoi(optarg);
+                if (sscanf(optarg, "%d:%d", &Params.alive_probability, &Params.alive_probability_to) != 2){
+                    Params.alive_probability_to = Params.alive_probability;
+                }
+                if (Params.alive_probability_to < Params.alive_probability){
+                    fprintf(stderr, "The range of probabilities `%s' is empty.\n", optarg);
+                    exit(1);
+                }
                 break;
 
             case 'e':
                 Params.max_iterations = atoi(optarg);
                 break;
 
+            case 'k':
+                Params.kernel = findKernel(optarg);
+                if (Params.kernel < 0){
+                    fprintf(stderr, "Unknown kernel `%s'.\n", optarg);
+                    exit(1);
+                }
+                break;
+
+            case 'i':
+                if (strcmp(optarg, "scalar") == 0){
+                    Params.isa = ISA_SCALAR;
+                }else if (strcmp(optarg, "sse2") == 0){
+                    Params.isa = ISA_SSE2;
+                }else if (strcmp(optarg, "avx2") == 0){
+                    Params.isa = ISA_AVX2;
+                }else if (strcmp(optarg, "avx512") == 0){
+                    Params.isa = ISA_AVX512;
+                }else{
+                    fprintf(stderr, "Unknown instruction set `%s'.\n", optarg);
+                    exit(1);
+                }
+                break;
+
+            case 'd':
+                Params.halo_depth = atoi(optarg);
+                if (Params.halo_depth < 1){
+                    fprintf(stderr, "The halo depth must be at least 1.\n");
+                    exit(1);
+                }
+                break;
+
+            case 'H':
+                Params.hashlife_generations = atoll(optarg);
+                if (Params.hashlife_generations < 0){
+                    fprintf(stderr, "HashLife can not go back in time.\n");
+                    exit(1);
+                }
+                break;
+
+            case 'M':
+                Params.hashlife_memory = atoi(optarg);
+                if (Params.hashlife_memory < 1){
+                    fprintf(stderr, "The HashLife node cache needs at least 1 MB.\n");
+                    exit(1);
+                }
+                break;
+
+            case 'C':
+                Params.hashlife_check = 1;
+                break;
+
+            case 'y':
+                Params.max_period = atoi(optarg);
+                break;
+
+            case 'S':
+                Params.seed       = strtoull(optarg, NULL, 10);
+                Params.seed_given = 1;
+                break;
+
+            case 'K':
+                Params.checkpoint_every = atoi(optarg);
+                break;
+
+            case 'F':
+                Params.checkpoint_file = optarg;
+                break;
+
+            case 'R':
+                Params.restart_file = optarg;
+                break;
+
+            case 'P':
+                // FILE or FILE@x,y
+                at = strrchr(optarg, '@');
+                if (at != NULL && sscanf(at + 1, "%d,%d", &Params.pattern_col, &Params.pattern_row) == 2) *at = '\0';
+                Params.pattern_file = optarg;
+                break;
+
+            case 'n':
+                Params.snapshot_every = atoi(optarg);
+                break;
+
+            case 'o':
+                Params.snapshot_file = optarg;
+                break;
+
+            case 'v':
+                Params.preview_factor = atoi(optarg);
+                if (Params.preview_factor < 1){
+                    fprintf(stderr, "The preview can not be larger than the board.\n");
+                    exit(1);
+                }
+                break;
+
+            case 'w':
+                Params.warmup_generations = atoi(optarg);
+                break;
+
+            case 'j':
+                Params.report_file = optarg;
+                break;
+
+            case 'T':
+                Params.trace_file = optarg;
+                break;
+
+            case 'B':
+                if (!parseRule(optarg, &Rule)){
+                    fprintf(stderr, "`%s' is not a rule like B3/S23.\n", optarg);
+                    exit(1);
+                }
+                Params.rule_given = 1;
+                break;
+
+            case 'b':
+                Params.bind_threads = 1;
+                break;
+
+            case 'm':
+                Params.shared_memory = 1;
+                break;
+
+            case 'N':
+                Params.neighbourhood = 1;
+                break;
+
+            case 'L':
+                Params.balance_every = atoi(optarg);
+                break;
+
+            case 'E':
+                Params.ensemble = atoi(optarg);
+                if (Params.ensemble < 1){
+                    fprintf(stderr, "An ensemble needs at least one seed.\n");
+                    exit(1);
+                }
+                break;
+
+            case 'X':
+                Params.ensemble_file = optarg;
+                break;
+
+            case 'I':
+                Params.imbalance = atoi(optarg);
+                if (Params.imbalance < 0){
+                    fprintf(stderr, "The imbalance is a percentage above the mean, it can not be negative.\n");
+                    exit(1);
+                }
+                break;
+
             case 'p':
+                print_flag = 1;
                 break;
 
             case 'h':
+                help_flag = 1;
                 break;
 
             case '?':
-                if (optopt == 'e' || optopt == 'a' || optopt == 't' || optopt == 's')
+                if (optopt == 'e' || optopt == 'a' || optopt == 't' || optopt == 's' || optopt == 'r' || optopt == 'c' || optopt == 'g' || optopt == 'k' || optopt == 'i' || optopt == 'd' || optopt == 'H' || optopt == 'M' || optopt == 'y' || optopt == 'S' || optopt == 'K' || optopt == 'F' || optopt == 'R' || optopt == 'P' || optopt == 'n' || optopt == 'o' || optopt == 'v' || optopt == 'w' || optopt == 'j' || optopt == 'T' || optopt == 'B' || optopt == 'L' || optopt == 'I' || optopt == 'E' || optopt == 'X')
                     fprintf (stderr, "Option -%c requires an argument.\n", optopt);
 
                 else if (isprint (optopt))
@@ -109,23 +384,154 @@ void parseCommandLineArguments(int argc, char* argv[]){
 
 
     if (help_flag){
-        char* helpMessage = "Usage: game -s SIZE [OPTION]...\n\nA parallel implementation of Game Of Life using MPI and OpenMP.\n\n\nMANDATORY OPTIONS:\n\n  -s, --size SIZE         Use board of SIZE rows and SIZE columns.\n\nIn this version SIZE must be devided by the square root of the number of MPI processes.\n\nOPTIONAL OPTIONS:\n\n  -t, --threads THR       Execute with THR threads (if possible) (Use -1 for maximum number possible - Default).\n  -a, --alive-prob PRO    Use PRO (in %) as probability of spawning an alive creature at each cell in the initial state. (default 15)\n  -e, --end NGEN          End the game after NGEN generations. (default 100) (Use -1 for infinite)\n  -p, --print             Print each state on screen.\n  -h, --help              Display this message and exit.\n";
-
-#pragma GCC diagnostic ignored "-Wformat-security"
-        printf(helpMessage);
+        char* helpMessage =
+            "Usage: game -s SIZE [OPTION]...\n"
+            "  or:  game -r ROWS -c COLS [OPTION]...\n"
+            "\n"
+            "A parallel implementation of Game Of Life using MPI and OpenMP.\n"
+            "\n"
+            "\n"
+            "MANDATORY OPTIONS:\n"
+            "\n"
+            "  -s, --size SIZE         Use board of SIZE rows and SIZE columns.\n"
+            "  -r, --rows ROWS         Use board of ROWS rows.\n"
+            "  -c, --cols COLS         Use board of COLS columns.\n"
+            "\n"
+            "The board is split in nearly equal blocks over a grid of processes, any number of processes can be used.\n"
+            "\n"
+            "OPTIONAL OPTIONS:\n"
+            "\n"
+            "  -g, --grid PxQ          Split the board over a grid of P rows and Q columns of processes. (default: chosen by MPI)\n"
+            "  -t, --threads THR       Execute with THR threads (if possible) (Use -1 for maximum number possible - Default).\n"
+            "  -a, --alive-prob PRO    Use PRO (in %) as probability of spawning an alive creature at each cell in the initial state. (default 15)\n"
+            "                          An ensemble (-E) takes a range of them, like 10:40.\n"
+            "  -e, --end NGEN          End the game after NGEN generations. (default 100) (Use -1 for infinite)\n"
+            "  -k, --kernel KERNEL     Compute generations with KERNEL: \"int\" (one int per cell - Default), \"packed\" (one bit per cell)\n"
+            "                          \"simd\" (one byte per cell, vectorized), \"tiled\" (simd, skipping the tiles where nothing changed)\n"
+            "                          or \"flat\" (the kernel of the CUDA version on the threads of a single process).\n"
+            "      --engine KERNEL     Same as --kernel.\n"
+            "  -i, --isa ISA           Use instruction set ISA in the simd and tiled kernels: \"scalar\", \"sse2\", \"avx2\" or \"avx512\". (default: best supported by the cpu)\n"
+            "  -d, --halo-depth K      Keep K ghost cells around each subboard and exchange them only every K generations,\n"
+            "                          recomputing the ghost cells locally in between. (default 1)\n"
+            "  -H, --hashlife NGEN     Fast-forward the initial board by NGEN generations with HashLife before playing,\n"
+            "                          the sides of the board must be powers of two. (default 0)\n"
+            "  -M, --hashlife-memory MB\n"
+            "                          Keep at most MB megabytes of HashLife nodes. (default 512)\n"
+            "  -C, --hashlife-check    Check the final board against the same generation computed by HashLife.\n"
+            "  -y, --cycle N           Stop as soon as the board repeats itself with a period of at most N generations\n"
+            "                          and report the period. (default: only stop when nothing changes)\n"
+            "  -S, --seed SEED         Draw the initial board from SEED, the same seed gives the same board on any number\n"
+            "                          of processes and threads. (default: the current time)\n"
+            "  -K, --checkpoint-every N\n"
+            "                          Write a checkpoint every N generations, blocks must be at least 8 columns wide.\n"
+            "  -F, --checkpoint-file FILE\n"
+            "                          Write the checkpoints to FILE. (default game.ckpt)\n"
+            "  -R, --restart FILE      Start from the board of checkpoint FILE instead of a random one, on any number of\n"
+            "                          processes. The size of the board comes from the file.\n"
+            "  -P, --pattern FILE[@X,Y]\n"
+            "                          Start from the pattern of FILE, in RLE or Life 1.06 format, with its top left corner\n"
+            "                          at column X and row Y (default 0,0) of an otherwise empty board. The file is read\n"
+            "                          in parallel, every process parses a share of it.\n"
+            "  -n, --snapshot-every N  Write the board every N generations as a PBM image, in parallel and in the background\n"
+            "                          while the game goes on. Blocks must be at least 8 columns wide.\n"
+            "  -o, --snapshot-file PREFIX\n"
+            "                          Name the images PREFIX followed by the generation and .pbm. (default frame)\n"
+            "  -v, --preview F         With every image, print the board shrunk F times on each side. Unlike --print, this\n"
+            "                          works with any size of board.\n"
+            "  -w, --warmup NGEN       Play NGEN generations before starting the clock. (default 0)\n"
+            "  -j, --report FILE       Append the size, kernel, process grid, threads, generations per second and time of\n"
+            "                          each phase of the run to FILE, as a CSV row or, if FILE ends in .json, a JSON line.\n"
+            "  -T, --trace FILE        Write the phases of every generation of every process to FILE as a Chrome trace\n"
+            "                          (chrome://tracing or ui.perfetto.dev). Builds with TIMERS=0 have no phases.\n"
+            "  -B, --rule RULE         Play the Life-like RULE in B/S notation, like B36/S23 (HighLife), B3678/S34678\n"
+            "                          (Day & Night) or B2/S (Seeds). (default B3/S23, or the rule of the checkpoint\n"
+            "                          or RLE pattern the game starts from)\n"
+            "  -b, --bind              Bind every thread to its own core, among the cores each process was given. The\n"
+            "                          threads compute and first touch the same rows of the board every generation, so\n"
+            "                          their memory stays on their NUMA node.\n"
+            "  -m, --shared-memory     Keep the boards of the processes of a node in MPI shared memory, where they copy\n"
+            "                          the edges of their neighbours on the node themselves. Only the edges of neighbours\n"
+            "                          on other nodes go in messages. For the int and simd kernels.\n"
+            "  -N, --neighbourhood     Exchange the halos with two MPI neighbourhood collectives per exchange over a graph\n"
+            "                          of the 4 direct neighbours, the corners riding along with the rows. For the int\n"
+            "                          and simd kernels.\n"
+            "  -L, --balance NGEN      Every NGEN generations, compare the time every process spent computing and, if they\n"
+            "                          are uneven, move the cuts between the blocks so that every row and column of\n"
+            "                          processes gets the same share of the work. Needs the phase timers. (default: never)\n"
+            "  -I, --imbalance PCT     Move the blocks only when the busiest process computed PCT% longer than the mean.\n"
+            "                          (default 10)\n"
+            "  -E, --ensemble N        Instead of one game, play N seeds (from -S on) of every probability of -a, which\n"
+            "                          may then be a range like 10:40, as independent boards of the given size, 64 at a\n"
+            "                          time in the bits of a word. Each board is played until it repeats one of its last\n"
+            "                          -y generations (default 1, a still life) or for -e generations.\n"
+            "  -X, --ensemble-file FILE\n"
+            "                          Write the seed, probability, settling generation, period and final population\n"
+            "                          of every board of the ensemble to FILE as CSV. (default ensemble.csv)\n"
+            "  -p, --print             Print each state on screen.\n"
+            "  -h, --help              Display this message and exit.\n";
+
+        fputs(helpMessage, stdout);
         exit(0);
     }
 
-    if (Params.Rows == -1 || Params.Cols == -1){
-        fprintf(stderr, "Option -s is required.\n");
+    if ((Params.Rows == -1 || Params.Cols == -1) && Params.restart_file == NULL){
+        fprintf(stderr, "Options -s or -r and -c (or -R) are required.\n");
+        exit(3);
+    }
+
+
+    if (Params.alive_probability_to != Params.alive_probability && Params.ensemble == 0){
+        fprintf(stderr, "A range of probabilities is for the boards of an ensemble (-E).\n");
         exit(3);
     }
 
+    if (Params.preview_factor > 0 && Params.snapshot_every <= 0){
+        fprintf(stderr, "The preview is shown with the images, option -v needs -n.\n");
+        exit(3);
+    }
 
     Params.should_print = print_flag;
 
 }
 
+// "B3/S23", "b3/s23", "S23/B3" or the older survive/born "23/3", with an optional ":" suffix (Golly's bounded grids)
+// that is ignored: the board is always a torus
+int parseRule(const char *text, struct rule *rule){
+    unsigned sets[2] = {0, 0};        // born, survive
+    int part, set, n, letters = 0;
+    const char *p = text;
+    char *name;
+
+    for (part = 0; part < 2; part++){
+        if (*p == 'B' || *p == 'b')      { set = 0; p++; letters++; }
+        else if (*p == 'S' || *p == 's') { set = 1; p++; letters++; }
+        else                             set = 1 - part;     // survive first without letters
+
+        for (; *p >= '0' && *p <= '8'; p++) sets[set] |= 1u << (*p - '0');
+
+        if (part == 0 && *p++ != '/') return 0;
+    }
+    if ((*p != '\0' && *p != ':') || letters == 1) return 0;
+
+    rule->born    = sets[0];
+    rule->survive = sets[1];
+
+    name = rule->name;
+    *name++ = 'B';
+    for (n = 0; n <= 8; n++) if (rule->born >> n & 1) *name++ = (char) ('0' + n);
+    *name++ = '/';
+    *name++ = 'S';
+    for (n = 0; n <= 8; n++) if (rule->survive >> n & 1) *name++ = (char) ('0' + n);
+    *name = '\0';
+
+    memset(rule->next, 0, sizeof(rule->next));
+    for (n = 0; n <= 8; n++){
+        rule->next[0][n] = (uint8_t) (rule->born >> n & 1);
+        rule->next[1][n] = (uint8_t) (rule->survive >> n & 1);
+    }
+    return 1;
+}
+
 // Actual MOD operation. (GCC's "%" doesn't always return positive values.)
 int mod(int a, int b){
     int ret=a%b;
@@ -135,50 +541,132 @@ int mod(int a, int b){
     return ret;
 }
 
-// This is an (emulated) namespace for directions
-struct directions{
-    int UP,
-        DOWN,
-        LEFT,
-        RIGHT,
-        UP_LEFT,
-        UP_RIGHT,
-        DOWN_LEFT,
-        DOWN_RIGHT;
-} Direction = {.UP =1000, .DOWN = 1001, .LEFT = 1002, .RIGHT = 1003, .UP_LEFT = 1004, .UP_RIGHT = 1005, .DOWN_LEFT=1006, .DOWN_RIGHT=1007};
+struct directions Direction = {.UP =1000, .DOWN = 1001, .LEFT = 1002, .RIGHT = 1003, .UP_LEFT = 1004, .UP_RIGHT = 1005, .DOWN_LEFT=1006, .DOWN_RIGHT=1007};
+
 
+struct grid Grid;
 
-// Auxiliary function for locating neighbouring processes
-int proc_id_right(int myid, int _N, int _M, int n){
-    return mod((myid + 1), _M) + (myid/_M) * _M;
+
+int blockSize(int n, int parts, int i){
+    return n / parts + (i < n % parts);
 }
 
-int proc_id_left(int myid, int _N, int _M, int n){
-    return (myid/_M) * _M + mod((myid - 1), _M);
+int blockStart(int n, int parts, int i){
+    return i * (n / parts) + (i < n % parts ? i : n % parts);
 }
 
-int proc_id_down(int myid, int _N, int _M, int n){
-    return mod(myid, _M) + mod((myid / _M + 1), _N) * _M;
+int blockRows(int i){
+    return Grid.row_start[i + 1] - Grid.row_start[i];
 }
 
-int proc_id_up(int myid, int _N, int _M, int n){
-    return mod(myid, _M) + mod((myid / _M - 1), _N) * _M;
+int blockCols(int j){
+    return Grid.col_start[j + 1] - Grid.col_start[j];
 }
 
-int proc_id_up_right(int myid, int _N, int _M, int n){
-    return proc_id_up(proc_id_right(myid, _N,_M, n), _N, _M, n);
+int blockRow0(int i){
+    return Grid.row_start[i];
 }
 
-int proc_id_down_right(int myid, int _N, int _M, int n){
-    return proc_id_down(proc_id_right(myid, _N,_M, n), _N, _M, n);
+int blockCol0(int j){
+    return Grid.col_start[j];
 }
 
-int proc_id_down_left(int myid, int _N, int _M, int n){
-    return proc_id_down(proc_id_left(myid, _N,_M, n), _N, _M, n);
+
+// rank of the process dr rows and dc columns away (the grid is periodic, so this wraps around)
+static int neighbour_rank(int dr, int dc){
+    int coords[2] = {Grid.coords[0] + dr, Grid.coords[1] + dc}, rank;
+    MPI_Cart_rank(Grid.comm, coords, &rank);
+    return rank;
 }
 
-int proc_id_up_left(int myid, int _N, int _M, int n){
-    return proc_id_up(proc_id_left(myid, _N, _M, n), _N, _M, n);
+// the format is only read on the master, the others may pass NULL
+void collectiveError(const char *format, ...){
+    int myid;
+    va_list args;
+
+    MPI_Comm_rank(MPI_COMM_WORLD, &myid);
+    if (I_AM_MASTER(myid)){
+        va_start(args, format);
+        vfprintf(stderr, format, args);
+        va_end(args);
+    }
+    MPI_Finalize();
+    exit(3);
+}
+
+void setupGrid(int numprocs){
+    int periods[2] = {1, 1}, myid, swap, i;
+
+    Grid.dims[0] = Params.proc_rows;
+    Grid.dims[1] = Params.proc_cols;
+    if (Params.proc_rows * Params.proc_cols != 0 && Params.proc_rows * Params.proc_cols != numprocs){
+        collectiveError("A %d x %d process grid needs %d processes, not %d.\n",
+                        Params.proc_rows, Params.proc_cols, Params.proc_rows * Params.proc_cols, numprocs);
+    }
+
+    MPI_Dims_create(numprocs, 2, Grid.dims);
+    if (Params.proc_rows == 0 && Params.proc_cols == 0 && Params.Cols > Params.Rows){
+        // MPI_Dims_create returns the larger dimension first: give it to the longer side of the board
+        swap = Grid.dims[0]; Grid.dims[0] = Grid.dims[1]; Grid.dims[1] = swap;
+    }
+
+    if (Params.Rows < Grid.dims[0] || Params.Cols < Grid.dims[1]){
+        collectiveError("A %d x %d board can not be split over a %d x %d process grid.\n",
+                        Params.Rows, Params.Cols, Grid.dims[0], Grid.dims[1]);
+    }
+
+    // the halos come from the next block only, so none of them may be thinner than the halo
+    if (Params.halo_depth > Params.Rows / Grid.dims[0] || Params.halo_depth > Params.Cols / Grid.dims[1]){
+        collectiveError("A halo of depth %d is deeper than the smallest block of a %d x %d board on a %d x %d process grid.\n",
+                        Params.halo_depth, Params.Rows, Params.Cols, Grid.dims[0], Grid.dims[1]);
+    }
+
+    // the bytes of checkpoints and images are written by the process of their first column, a block must fill them
+    if ((Params.checkpoint_every > 0 || Params.snapshot_every > 0) && Grid.dims[1] > 1 && Params.Cols / Grid.dims[1] < 8){
+        collectiveError("Checkpoints and images need blocks at least 8 columns wide, a %d x %d board on a %d x %d process grid has narrower ones.\n",
+                        Params.Rows, Params.Cols, Grid.dims[0], Grid.dims[1]);
+    }
+
+    if ((Params.hashlife_generations > 0 || Params.hashlife_check) && !hashlifeSupported()){
+        collectiveError("HashLife needs the sides of the board to be powers of two, not %d x %d.\n", Params.Rows, Params.Cols);
+    }
+
+    MPI_Cart_create(MPI_COMM_WORLD, 2, Grid.dims, periods, 0, &Grid.comm);
+    MPI_Comm_rank(Grid.comm, &myid);
+    MPI_Cart_coords(Grid.comm, myid, 2, Grid.coords);
+
+    Grid.node = MPI_COMM_NULL;
+    if (Params.shared_memory) MPI_Comm_split_type(Grid.comm, MPI_COMM_TYPE_SHARED, myid, MPI_INFO_NULL, &Grid.node);
+
+    Grid.row_start = malloc(sizeof(int) * (Grid.dims[0] + 1));
+    Grid.col_start = malloc(sizeof(int) * (Grid.dims[1] + 1));
+    for (i = 0; i <= Grid.dims[0]; i++) Grid.row_start[i] = blockStart(Params.Rows, Grid.dims[0], i);
+    for (i = 0; i <= Grid.dims[1]; i++) Grid.col_start[i] = blockStart(Params.Cols, Grid.dims[1], i);
+
+    Grid.rows = blockRows(Grid.coords[0]);
+    Grid.cols = blockCols(Grid.coords[1]);
+    Grid.row0 = blockRow0(Grid.coords[0]);
+    Grid.col0 = blockCol0(Grid.coords[1]);
+
+    Grid.id_up         = neighbour_rank(-1,  0);
+    Grid.id_down       = neighbour_rank( 1,  0);
+    Grid.id_left       = neighbour_rank( 0, -1);
+    Grid.id_right      = neighbour_rank( 0,  1);
+    Grid.id_up_left    = neighbour_rank(-1, -1);
+    Grid.id_up_right   = neighbour_rank(-1,  1);
+    Grid.id_down_left  = neighbour_rank( 1, -1);
+    Grid.id_down_right = neighbour_rank( 1,  1);
+
+    // the neighbours of a process are fixed for the game, even when the blocks move
+    Grid.graph = MPI_COMM_NULL;
+    if (Params.neighbourhood){
+        int destinations[4] = {Grid.id_up,   Grid.id_down, Grid.id_left,  Grid.id_right};
+        int sources[4]      = {Grid.id_down, Grid.id_up,   Grid.id_right, Grid.id_left};
+        int weights[4]      = {1, 1, 1, 1};    // as MPI_UNWEIGHTED, which gcc takes for an empty array with Open MPI
+
+        MPI_Dist_graph_create_adjacent(Grid.comm, 4, sources, weights, 4, destinations, weights,
+                                       MPI_INFO_NULL, 0, &Grid.graph);
+    }
 }
 
 
@@ -218,13 +706,15 @@ int cell_up_left(int myid, int _M){
 
 
 // Business Logic Functions
-void printState(int numprocs, int width, int *** board){
-    int row, col, i, j;
-    for(i=0;i<(int) sqrt(numprocs);i++){
-        for (row=0; row<width; row++){
-            for (j=0; j< (int) sqrt(numprocs); j++){
-                for (col=0; col < width; col++){
-                    printf("%c ",(board[i][j][row*width+col] == 0) ? EMPTY_SYMBOL : (board[i][j][row*width+col] == 1) ? CREATURE_SYMBOL : '?');
+void printState(int *** board){
+    int row, col, i, j, rows, cols;
+    for(i=0;i<Grid.dims[0];i++){
+        rows = blockRows(i);
+        for (row=0; row<rows; row++){
+            for (j=0; j<Grid.dims[1]; j++){
+                cols = blockCols(j);
+                for (col=0; col < cols; col++){
+                    printf("%c ",(board[i][j][row*cols+col] == 0) ? EMPTY_SYMBOL : (board[i][j][row*cols+col] == 1) ? CREATURE_SYMBOL : '?');
                 }
             }
             printf("\n");
@@ -233,165 +723,122 @@ void printState(int numprocs, int width, int *** board){
 }
 
 // TODO: mention probability parameter
-void initializeBoard(int *subboard, int dimX, int dimY, int prob){
-
-    float _prob = 1.0f - prob / 100.0f;
-    int i;
-    for(i=0;i<dimX*dimY;i++){
-        subboard[i]=rand()/(float) RAND_MAX > _prob;
+// Every cell is alive with the given probability, drawn from a hash of the seed and its position on the whole board:
+// the board is the same whatever the process grid and the number of threads, and any cell can be drawn first.
+void initializeBoard(int *subboard, int rows, int cols, int row0, int col0, int prob, unsigned long long board_seed){
+
+    uint64_t seed = mixHash(board_seed), threshold = ((uint64_t) prob << 32) / 100;  // out of 2^32
+    uint64_t index;
+    int row, col;
+
+#pragma omp parallel for private(col, index) schedule(static)
+    for (row = 0; row < rows; row++){
+        index = (uint64_t) (row0 + row) * (uint64_t) Params.Cols + (uint64_t) col0;
+        for (col = 0; col < cols; col++){
+            subboard[row*cols+col] = (mixHash(seed + (index + col) * 0x9E3779B97F4A7C15ULL) >> 32) < threshold;
+        }
     }
-
-}
-
-
-
-int isOuter(int i, int width){
-    return ((mod(i, width) == 0) || (mod(i, width) == width - 1) || (i < width) || (i >= width * width - width));
 }
 
 
 
-
-int countNeighboursInner(int i, const int *temp, int width){
+// Number of alive neighbours of cell i of a padded subboard. The ghost cells make this the same for every cell.
+int countNeighbours(int i, const int *temp, int pitch){
 
     int sum;
 
-    sum =   temp[cell_up_left(i,width)]
-            +temp[cell_up(i,width)]
-            +temp[cell_up_right(i,width)]
-            +temp[cell_left(i,width)]
-            +temp[cell_right(i,width)]
-            +temp[cell_down_left(i,width)]
-            +temp[cell_down(i,width)]
-            +temp[cell_down_right(i,width)];
+    sum =   temp[cell_up_left(i,pitch)]
+            +temp[cell_up(i,pitch)]
+            +temp[cell_up_right(i,pitch)]
+            +temp[cell_left(i,pitch)]
+            +temp[cell_right(i,pitch)]
+            +temp[cell_down_left(i,pitch)]
+            +temp[cell_down(i,pitch)]
+            +temp[cell_down_right(i,pitch)];
 
     return sum;
 
 }
 
 
+struct region stepRegion(int rows, int cols, int depth, int step){
+    struct region region = {step + 1, rows + 2*depth - 1 - step, step + 1, cols + 2*depth - 1 - step};
+    return region;
+}
 
-int countNeighboursOuter(int i, const int *temp, int width, int *up_buffer, int *down_buffer, int *left_buffer,
-                    int *right_buffer, int up_left_buffer, int up_right_buffer,
-                    int down_left_buffer, int down_right_buffer){
+struct region innerRegion(int rows, int cols, int depth){
+    struct region region = {depth + 1, depth + rows - 1, depth + 1, depth + cols - 1};
+    return region;
+}
 
-    int sum;
+int frameRegions(struct region outer, struct region inner, struct region strips[4]){
+    struct region top    = {outer.row_from, inner.row_from, outer.col_from, outer.col_to};
+    struct region bottom = {inner.row_to,   outer.row_to,   outer.col_from, outer.col_to};
+    struct region left   = {inner.row_from, inner.row_to,   outer.col_from, inner.col_from};
+    struct region right  = {inner.row_from, inner.row_to,   inner.col_to,   outer.col_to};
+    int n = 0;
 
-    if((i<width) && !(mod(i,width)==0) && !(mod(i,width)==(width-1))){		//up edge
-        sum =   up_buffer[i]
-                +up_buffer[i-1]
-                +up_buffer[i+1]
-                +temp[cell_left(i,width)]
-                +temp[cell_right(i,width)]
-                +temp[cell_down_left(i,width)]
-                +temp[cell_down(i,width)]
-                +temp[cell_down_right(i,width)];
-    }
-    else if(!(mod(i,width)==0) && !(mod(i,width)==(width-1)) && (i>=width*width-width)){		//down edge
-        sum =   temp[cell_up_left(i,width)]
-                +temp[cell_up(i,width)]
-                +temp[cell_up_right(i,width)]
-                +temp[cell_left(i,width)]
-                +temp[cell_right(i,width)]
-                +down_buffer[mod(i,width)]
-                +down_buffer[mod(i, width)-1]
-                +down_buffer[mod(i, width)+1];
-    }
-    else if((mod(i,width)==0) && !(i<width) && !(i>=width*width-width)){		//left edge
-        sum =   temp[cell_up(i,width)]
-                +temp[cell_up_right(i,width)]
-                +temp[cell_right(i,width)]
-                +temp[cell_down(i,width)]
-                +temp[cell_down_right(i,width)]
-                +left_buffer[i/width-1]
-                +left_buffer[i/width]
-                +left_buffer[i/width+1];
-    }
-    else if((mod(i,width)==(width-1)) && !(i<width) && !(i>=width*width-width)){		//right edge
-        sum =   temp[cell_up_left(i,width)]
-                +temp[cell_up(i,width)]
-                +temp[cell_left(i,width)]
-                +temp[cell_down_left(i,width)]
-                +temp[cell_down(i,width)]
-                +right_buffer[i/width-1]
-                +right_buffer[i/width]
-                +right_buffer[i/width+1];
-    }
-    else if(i==0){		//up-left corner
-        sum =   up_buffer[0]
-                +up_buffer[1]
-                +left_buffer[0]
-                +left_buffer[1]
-                +up_left_buffer
-                +temp[cell_right(i,width)]
-                +temp[cell_down(i,width)]
-                +temp[cell_down_right(i,width)];
-    }
-    else if(i==(width-1)){		//up-right corner
-        sum =   temp[cell_left(i,width)]
-                +temp[cell_down_left(i,width)]
-                +temp[cell_down(i,width)]
-                +up_buffer[width-2]
-                +up_buffer[width-1]
-                +right_buffer[0]
-                +right_buffer[1]
-                +up_right_buffer;
-    }
-    else if(i==(width*(width-1))){		//down-left corner
-        sum =   temp[cell_up(i,width)]
-                +temp[cell_up_right(i,width)]
-                +temp[cell_right(i,width)]
-                +down_buffer[0]
-                +down_buffer[1]
-                +left_buffer[width-1]
-                +left_buffer[width-2]
-                +down_left_buffer;
-    }
-    else if(i==((width*width)-1)){		//down-right corner
-        sum =   temp[cell_up_left(i,width)]
-                +temp[cell_up(i,width)]
-                +temp[cell_left(i,width)]
-                +right_buffer[width-1]
-                +right_buffer[width-2]
-                +down_buffer[width-1]
-                +down_buffer[width-2]
-                +down_right_buffer;
-    }else{
-        assert(1==2); // should never go here
+    if (inner.row_from >= inner.row_to || inner.col_from >= inner.col_to){
+        strips[n++] = outer; // nothing inside, all of it is frame
+        return n;
     }
+    if (top.row_from    < top.row_to)    strips[n++] = top;
+    if (bottom.row_from < bottom.row_to) strips[n++] = bottom;
+    if (left.col_from   < left.col_to)   strips[n++] = left;
+    if (right.col_from  < right.col_to)  strips[n++] = right;
+    return n;
+}
 
-    return sum;
+
+struct region threadBand(struct region region){
+    int thread = 0, threads = 1, rows = region.row_to - region.row_from;
+
+#ifdef _OPENMP
+    thread  = omp_get_thread_num();
+    threads = omp_get_num_threads();
+#endif
+    if (rows <= 0) return region;
+    region.row_from += blockStart(rows, threads, thread);
+    region.row_to    = region.row_from + blockSize(rows, threads, thread);
+    return region;
 }
 
+void touchRows(void *cells, size_t row_size, int rows){
+    struct region all = {0, rows, 0, 0}, band;
 
+#pragma omp parallel private(band)
+    {
+        band = threadBand(all);
+        memset((char *) cells + (size_t) band.row_from * row_size, 0, (size_t) (band.row_to - band.row_from) * row_size);
+    }
+}
 
-int updateLocalState(const int *sums, int *temp, int width){
 
-    int i, flag=0;
 
-#pragma omp for private(i)
-    for(i=0;i<width*width;i++){
+// One pass per cell: the neighbours are counted in cur and the next state is written straight to next, so no count
+// of the whole region is stored and read back. The three rows around a cell are walked side by side.
+int evolveIntBand(const int *cur, int *next, int pitch, struct region region){
 
-            if ((sums[i] == 0) || (sums[i] == 1)) {
-                if (temp[i] == 1) {
-                    temp[i] = 0;
-                    flag = 1;
-                }
-            } else if ((sums[i] == 2) || (sums[i] == 3)) {
-                if (sums[i] == 2) {}
-                else {
-                    if (temp[i] == 0) {
-                        temp[i] = 1;
-                        flag = 1;
-                    }
-                }
-            } else if ((sums[i] == 4) || (sums[i] == 5) || (sums[i] == 6) || (sums[i] == 7) || (sums[i] == 8)) {
-                if (temp[i] == 1) {
-                    temp[i] = 0;
-                    flag = 1;
-                }
+    int row, col, block, end, sum, state, flag = 0;
+    const int *up, *mid, *down;
+    struct region band = threadBand(region);
+    double busy = phaseClock();
+
+    for (block = band.col_from; block < band.col_to; block += BLOCK_COLUMNS(sizeof(int))){
+        end = (block + BLOCK_COLUMNS(sizeof(int)) < band.col_to) ? block + BLOCK_COLUMNS(sizeof(int)) : band.col_to;
+        for (row = band.row_from; row < band.row_to; row++){
+            up   = &cur[(row-1)*pitch];
+            mid  = &cur[row*pitch];
+            down = &cur[(row+1)*pitch];
+            for (col = block; col < end; col++){
+                sum   = up[col-1] + up[col] + up[col+1] + mid[col-1] + mid[col+1] + down[col-1] + down[col] + down[col+1];
+                state = Rule.next[mid[col]][sum];    // a lookup in the table of the rule, the same for any rule
+                flag |= state ^ mid[col];
+                next[row*pitch+col] = state;
             }
+        }
     }
+    lapThread(busy);
     return flag;
 }
 
@@ -403,64 +850,348 @@ int checkGlobalStateChanged(int myState){
     return change;
 }
 
-// TO CHECK: sending to different neighbours uses different tags
-void sendPeripheralsToNeighbours(int myid, int *temp, int width, int numprocs,
-                                 MPI_Request *sHandlerUp, MPI_Request *sHandlerDown, MPI_Request *sHandlerLeft, MPI_Request *sHandlerRight,
-                                 MPI_Request *sHandlerUpLeft, MPI_Request *sHandlerUpRight, MPI_Request *sHandlerDownLeft, MPI_Request *sHandlerDownRight){
-    int i,j;
 
-    int id_up         = proc_id_up        (myid,(int)sqrt(numprocs), (int)sqrt(numprocs), numprocs);
-    int id_down       = proc_id_down      (myid,(int)sqrt(numprocs), (int)sqrt(numprocs), numprocs);
-    int id_right      = proc_id_right     (myid,(int)sqrt(numprocs), (int)sqrt(numprocs), numprocs);
-    int id_left       = proc_id_left      (myid,(int)sqrt(numprocs), (int)sqrt(numprocs), numprocs);
-    int id_up_left    = proc_id_up_left   (myid,(int)sqrt(numprocs), (int)sqrt(numprocs), numprocs);
-    int id_up_right   = proc_id_up_right  (myid,(int)sqrt(numprocs), (int)sqrt(numprocs), numprocs);
-    int id_down_left  = proc_id_down_left (myid,(int)sqrt(numprocs), (int)sqrt(numprocs), numprocs);
-    int id_down_right = proc_id_down_right(myid,(int)sqrt(numprocs), (int)sqrt(numprocs), numprocs);
+uint64_t mixHash(uint64_t x){
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+uint64_t hashCells(uint64_t hash, const void *data, size_t size){
+    const unsigned char *bytes = data;
+    uint64_t word;
+    size_t i;
+
+    for (i = 0; i + 8 <= size; i += 8){
+        memcpy(&word, bytes + i, 8);
+        hash = (hash ^ word) * 0x100000001B3ULL;
+        hash ^= hash >> 32;
+    }
+    for (; i < size; i++) hash = (hash ^ bytes[i]) * 0x100000001B3ULL;
+    return mixHash(hash);
+}
+
+int hashPieces(int rows, int cols, int depth, struct region region, struct region pieces[3]){
+    int cuts[4] = {depth, depth + (cols < 1 ? cols : 1), 0, depth + cols};
+    int i, n = 0;
+
+    cuts[2] = (depth + cols - 1 > cuts[1]) ? depth + cols - 1 : cuts[1];
+    if (region.row_from < depth) region.row_from = depth;
+    if (region.row_to > depth + rows) region.row_to = depth + rows;
+    if (region.row_from >= region.row_to) return 0;
+
+    for (i = 0; i < 3; i++){
+        if (cuts[i] < cuts[i+1] && cuts[i] >= region.col_from && cuts[i+1] <= region.col_to){
+            pieces[n]          = region;
+            pieces[n].col_from = cuts[i];
+            pieces[n].col_to   = cuts[i+1];
+            n++;
+        }
+    }
+    return n;
+}
+
+uint64_t pieceSeed(int row, int col){
+    return mixHash(((uint64_t) row << 32) | (uint32_t) col);
+}
+
+uint64_t hashPaddedBand(const void *board, int cell_size, int rows, int cols, int pitch, int depth, struct region region){
+    struct region pieces[3];
+    int n = hashPieces(rows, cols, depth, region, pieces), i, r;
+    size_t size;
+    uint64_t hash = 0;
+
+    for (i = 0; i < n; i++){
+        size = (size_t) (pieces[i].col_to - pieces[i].col_from) * cell_size;
+        for (r = pieces[i].row_from; r < pieces[i].row_to; r++){
+            hash ^= hashCells(pieceSeed(r, pieces[i].col_from), (const char *) board + ((size_t) r * pitch + pieces[i].col_from) * cell_size, size);
+        }
+    }
+    return hash;
+}
+
+uint64_t hashPaddedBoard(const void *board, int cell_size, int rows, int cols, int pitch, int depth){
+    struct region subboard = {depth, depth + rows, depth, depth + cols};
+    return hashPaddedBand(board, cell_size, rows, cols, pitch, depth, subboard);
+}
+
+// address of element (row, col) of a padded subboard
+static char *padded_cell(void *board, MPI_Datatype cell, int pitch, int row, int col){
+    int size;
+    MPI_Type_size(cell, &size);
+    return (char *) board + ((size_t) row * pitch + col) * size;
+}
+
+// Where each message of the exchange is received to and sent from, in request order (up, down, left, right,
+// up-left, up-right, down-left, down-right) and padded coordinates
+struct halo_block{
+    int row, col;
+    MPI_Datatype type;
+    int peer, tag;
+};
+
+static void halo_blocks(const struct halo *halo, int rows, int cols, int k, struct halo_block recv[8], struct halo_block send[8]){
+    struct halo_block r[8] = {
+        {0,        k,        halo->row,    Grid.id_up,         Direction.DOWN},
+        {rows + k, k,        halo->row,    Grid.id_down,       Direction.UP},
+        {k,        0,        halo->column, Grid.id_left,       Direction.RIGHT},
+        {k,        cols + k, halo->column, Grid.id_right,      Direction.LEFT},
+        {0,        0,        halo->corner, Grid.id_up_left,    Direction.DOWN_RIGHT},
+        {0,        cols + k, halo->corner, Grid.id_up_right,   Direction.DOWN_LEFT},
+        {rows + k, 0,        halo->corner, Grid.id_down_left,  Direction.UP_RIGHT},
+        {rows + k, cols + k, halo->corner, Grid.id_down_right, Direction.UP_LEFT}
+    };
+    struct halo_block s[8] = {
+        {k,        k,        halo->row,    Grid.id_up,         Direction.UP},
+        {rows,     k,        halo->row,    Grid.id_down,       Direction.DOWN},
+        {k,        k,        halo->column, Grid.id_left,       Direction.LEFT},
+        {k,        cols,     halo->column, Grid.id_right,      Direction.RIGHT},
+        {k,        k,        halo->corner, Grid.id_up_left,    Direction.UP_LEFT},
+        {k,        cols,     halo->corner, Grid.id_up_right,   Direction.UP_RIGHT},
+        {rows,     k,        halo->corner, Grid.id_down_left,  Direction.DOWN_LEFT},
+        {rows,     cols,     halo->corner, Grid.id_down_right, Direction.DOWN_RIGHT}
+    };
+
+    memcpy(recv, r, sizeof(r));
+    memcpy(send, s, sizeof(s));
+}
+
+void clearHalo(struct halo *halo){
+    int i;
+
+    halo->row = halo->column = halo->corner = MPI_DATATYPE_NULL;
+    for (i = 0; i < 16; i++) halo->requests[i] = MPI_REQUEST_NULL;
+    halo->messages = 16;
+    halo->window   = MPI_WIN_NULL;
+    halo->copies   = 0;
+    halo->band     = MPI_DATATYPE_NULL;
+    halo->collective = 0;
+    halo->phase      = 0;
+    halo->round      = 0;
+}
+
+void setupHaloTypes(struct halo *halo, MPI_Datatype cell, int rows, int cols, int pitch, int depth){
+
+    clearHalo(halo);
+    MPI_Type_vector(depth, cols,  pitch, cell, &halo->row);
+    MPI_Type_vector(rows,  depth, pitch, cell, &halo->column);
+    MPI_Type_vector(depth, depth, pitch, cell, &halo->corner);
+    MPI_Type_commit(&halo->row);
+    MPI_Type_commit(&halo->column);
+    MPI_Type_commit(&halo->corner);
+}
+
+// Rank in Grid.node of the neighbour of every receive, MPI_UNDEFINED for the ones on other nodes
+static void node_peers(const struct halo_block recv[8], int peers[8]){
+    MPI_Group grid_group, node_group;
+    int ranks[8], i;
+
+    for (i = 0; i < 8; i++) ranks[i] = recv[i].peer;
+    MPI_Comm_group(Grid.comm, &grid_group);
+    MPI_Comm_group(Grid.node, &node_group);
+    MPI_Group_translate_ranks(grid_group, 8, ranks, node_group, peers);
+    MPI_Group_free(&grid_group);
+    MPI_Group_free(&node_group);
+}
+
+// Blocks of the two collectives, in the order of the neighbours of Grid.graph: the sends go up, down, left and right,
+// the receives come from down, up, right and left. Between two processes that are both above and below each other
+// (or left and right) the messages match in that order, so what goes up arrives from below.
+static const int collective_counts[2][4] = {{0, 0, 1, 1}, {1, 1, 0, 0}};
+
+static void setup_collective_halo(struct halo *halo, void *board, MPI_Datatype cell, int rows, int cols, int pitch, int k){
+    struct { int row, col; } blocks[2][4] = {
+        {{k, 0},        {rows, 0}, {k, k},        {k, cols}},              // sent: top rows, bottom rows, columns
+        {{rows + k, 0}, {0, 0},    {k, cols + k}, {k, 0}}                  // received into the ghost cells
+    };
+    int side, i;
+
+    MPI_Type_contiguous(k * pitch, cell, &halo->band);
+    MPI_Type_commit(&halo->band);
+
+    for (side = 0; side < 2; side++){
+        for (i = 0; i < 4; i++){
+            halo->types[side][i] = (i < 2) ? halo->band : halo->column;
+            MPI_Get_address(padded_cell(board, cell, pitch, blocks[side][i].row, blocks[side][i].col), &halo->displs[side][i]);
+        }
+    }
+    halo->collective = 1;
+    halo->messages   = 1;
+}
+
+void setupPaddedHalo(struct halo *halo, void *board, MPI_Win window, MPI_Datatype cell, int rows, int cols, int pitch, int depth){
+
+    static const int sent_by[8] = {1, 0, 3, 2, 7, 6, 5, 4};  // the neighbour's send that fills each receive
+    struct halo_block recv[8], send[8];
+    MPI_Aint mine[9], *edges = NULL, segment;               // where the 8 edges of a board are in its segment, and its pitch
+    int peers[8], i, size, unit, myrank, count, recvs = 0, sends = 0;
+    MPI_Request requests[16];
+    struct haloCopy *copy;
+    char *base;
+
+    setupHaloTypes(halo, cell, rows, cols, pitch, depth);
+    if (Grid.graph != MPI_COMM_NULL){
+        setup_collective_halo(halo, board, cell, rows, cols, pitch, depth);
+        return;
+    }
+    halo_blocks(halo, rows, cols, depth, recv, send);
+    MPI_Type_size(cell, &size);
+    for (i = 0; i < 8; i++) peers[i] = MPI_UNDEFINED;
+
+    if (window != MPI_WIN_NULL){
+        halo->window = window;
+        node_peers(recv, peers);
+
+        MPI_Comm_rank(Grid.node, &myrank);
+        MPI_Comm_size(Grid.node, &count);
+        MPI_Win_shared_query(window, myrank, &segment, &unit, &base);
+        for (i = 0; i < 8; i++) mine[i] = padded_cell(board, cell, pitch, send[i].row, send[i].col) - base;
+        mine[8] = (MPI_Aint) pitch * size;
+
+        edges = malloc(sizeof(mine) * count);
+        MPI_Allgather(mine, 9, MPI_AINT, edges, 9, MPI_AINT, Grid.node);
+    }
+
+    for (i = 0; i < 8; i++){
+        if (peers[i] != MPI_UNDEFINED){
+            MPI_Win_shared_query(window, peers[i], &segment, &unit, &base);
+            copy = &halo->copy[halo->copies++];
+            copy->to         = padded_cell(board, cell, pitch, recv[i].row, recv[i].col);
+            copy->from       = base + edges[9 * peers[i] + sent_by[i]];
+            copy->rows       = (i == 2 || i == 3) ? rows : depth;
+            copy->bytes      = (size_t) ((i == 0 || i == 1) ? cols : depth) * size;
+            copy->to_pitch   = (size_t) pitch * size;
+            copy->from_pitch = (size_t) edges[9 * peers[i] + 8];
+            continue;
+        }
+        MPI_Recv_init(padded_cell(board, cell, pitch, recv[i].row, recv[i].col), 1, recv[i].type, recv[i].peer, recv[i].tag, Grid.comm, &requests[recvs++]);
+    }
+    // a neighbour on the node reads the edge of this board by itself
+    for (i = 0; i < 8; i++){
+        if (peers[i] != MPI_UNDEFINED) continue;
+        MPI_Send_init(padded_cell(board, cell, pitch, send[i].row, send[i].col), 1, send[i].type, send[i].peer, send[i].tag, Grid.comm, &requests[8 + sends++]);
+    }
+
+    halo->messages = recvs + sends;
+    memcpy(halo->requests, requests, sizeof(MPI_Request) * recvs);
+    memcpy(halo->requests + recvs, requests + 8, sizeof(MPI_Request) * sends);
+    free(edges);
+}
+
+// A receiver can not tell in advance which edges will come: one may change because of cells it never sees, deeper in
+// the sender's block or in the block of a third process at a corner. So the changed edges are synchronous sends, the
+// receiver takes the edges that arrive, and a non-blocking barrier, entered once all of its own sends were taken,
+// closes the exchange when every process is done (the NBX algorithm). A neighbour already in the next exchange can
+// not enter the barrier of this one, so two exchanges in a row using different tags is enough to keep them apart.
+static int sparse_tag(const struct halo *halo, int tag){
+    return tag + 8 * halo->round;
+}
+
+void startSparseHalo(struct halo *halo, void *board, MPI_Datatype cell, int rows, int cols, int pitch, const int changed[8]){
+
+    struct halo_block recv[8], send[8];
+    int i;
+
+    halo_blocks(halo, rows, cols, 1, recv, send);
+
+    for (i = 0; i < 8; i++){
+        halo->requests[8 + i] = MPI_REQUEST_NULL;
+        if (!changed[i]) continue;
+        MPI_Issend(padded_cell(board, cell, pitch, send[i].row, send[i].col), 1, send[i].type, send[i].peer,
+                   sparse_tag(halo, send[i].tag), Grid.comm, &halo->requests[8 + i]);
+    }
+}
+
+void finishSparseHalo(struct halo *halo, void *board, MPI_Datatype cell, int rows, int cols, int pitch, int received[8]){
+
+    struct halo_block recv[8], send[8];
+    int i, arrived, sent = 0, done = 0;
 
+    halo_blocks(halo, rows, cols, 1, recv, send);
+    for (i = 0; i < 8; i++) received[i] = 0;
 
-    MPI_Datatype columnVector;
-    MPI_Type_vector(width,1,width,MPI_INT,&columnVector);
-    MPI_Type_commit(&columnVector);
+    while (!done){
+        for (i = 0; i < 8; i++){
+            if (received[i]) continue;
+            MPI_Iprobe(recv[i].peer, sparse_tag(halo, recv[i].tag), Grid.comm, &arrived, MPI_STATUS_IGNORE);
+            if (!arrived) continue;
+            MPI_Recv(padded_cell(board, cell, pitch, recv[i].row, recv[i].col), 1, recv[i].type, recv[i].peer,
+                     sparse_tag(halo, recv[i].tag), Grid.comm, MPI_STATUS_IGNORE);
+            received[i] = 1;
+        }
 
-    MPI_Isend(temp,                     width, MPI_INT,      id_up,         Direction.UP,         MPI_COMM_WORLD, &(*sHandlerUp));
-    MPI_Isend(&(temp[width*(width-1)]), width, MPI_INT,      id_down,       Direction.DOWN,       MPI_COMM_WORLD, &(*sHandlerDown));
-    MPI_Isend(temp,                     1,     columnVector, id_left,       Direction.LEFT,       MPI_COMM_WORLD, &(*sHandlerLeft));
-    MPI_Isend(&(temp[width-1]),         1,     columnVector, id_right,      Direction.RIGHT,      MPI_COMM_WORLD, &(*sHandlerRight));
-    MPI_Isend(temp,                     1,     MPI_INT,      id_up_left,    Direction.UP_LEFT,    MPI_COMM_WORLD, &(*sHandlerUpLeft));
-    MPI_Isend(&(temp[width-1]),         1,     MPI_INT,      id_up_right,   Direction.UP_RIGHT,   MPI_COMM_WORLD, &(*sHandlerUpRight));
-    MPI_Isend(&(temp[width*(width-1)]), 1,     MPI_INT,      id_down_left,  Direction.DOWN_LEFT,  MPI_COMM_WORLD, &(*sHandlerDownLeft));
-    MPI_Isend(&(temp[width*width-1]),   1,     MPI_INT,      id_down_right, Direction.DOWN_RIGHT, MPI_COMM_WORLD, &(*sHandlerDownRight));
+        if (!sent){
+            MPI_Testall(8, halo->requests + 8, &sent, MPI_STATUSES_IGNORE);
+            if (sent) MPI_Ibarrier(Grid.comm, &halo->requests[0]);
+        } else {
+            MPI_Test(&halo->requests[0], &done, MPI_STATUS_IGNORE);
+        }
+    }
+    halo->round = 1 - halo->round;
+}
 
+// the columns (phase 0) or the rows (phase 1), the blocks are given by their addresses
+static void start_collective(struct halo *halo, int phase){
+    MPI_Ineighbor_alltoallw(MPI_BOTTOM, collective_counts[phase], halo->displs[0], halo->types[0],
+                            MPI_BOTTOM, collective_counts[phase], halo->displs[1], halo->types[1],
+                            Grid.graph, &halo->requests[0]);
 }
 
+void startHalo(struct halo *halo){
+    const struct haloCopy *copy;
+    int i, row;
+
+    if (halo->collective){
+        halo->phase = 0;
+        start_collective(halo, 0);
+        return;
+    }
+
+    MPI_Startall(halo->messages, halo->requests);
+    if (halo->window == MPI_WIN_NULL) return;
 
-// TO CHECK: reversed Directions tags
-void receivePeripheralsFromNeighbours(int myid, int width, int numprocs, int *up_buffer, int *down_buffer, int *left_buffer,
-                                      int *right_buffer, int *up_left_buffer, int *up_right_buffer, int *down_left_buffer, int *down_right_buffer,
-                                      MPI_Request *rHandlerUp, MPI_Request *rHandlerDown, MPI_Request *rHandlerLeft, MPI_Request *rHandlerRight,
-                                      MPI_Request *rHandlerUpLeft, MPI_Request *rHandlerUpRight, MPI_Request *rHandlerDownLeft, MPI_Request *rHandlerDownRight){
+    // the neighbours on the node wrote their edges before they got here
+    MPI_Win_sync(halo->window);
+    MPI_Barrier(Grid.node);
+    MPI_Win_sync(halo->window);
 
-    int id_up         = proc_id_up        (myid,(int)sqrt(numprocs), (int)sqrt(numprocs), numprocs);
-    int id_down       = proc_id_down      (myid,(int)sqrt(numprocs), (int)sqrt(numprocs), numprocs);
-    int id_right      = proc_id_right     (myid,(int)sqrt(numprocs), (int)sqrt(numprocs), numprocs);
-    int id_left       = proc_id_left      (myid,(int)sqrt(numprocs), (int)sqrt(numprocs), numprocs);
-    int id_up_left    = proc_id_up_left   (myid,(int)sqrt(numprocs), (int)sqrt(numprocs), numprocs);
-    int id_up_right   = proc_id_up_right  (myid,(int)sqrt(numprocs), (int)sqrt(numprocs), numprocs);
-    int id_down_left  = proc_id_down_left (myid,(int)sqrt(numprocs), (int)sqrt(numprocs), numprocs);
-    int id_down_right = proc_id_down_right(myid,(int)sqrt(numprocs), (int)sqrt(numprocs), numprocs);
+    for (i = 0; i < halo->copies; i++){
+        copy = &halo->copy[i];
+        for (row = 0; row < copy->rows; row++) memcpy(copy->to + row * copy->to_pitch, copy->from + row * copy->from_pitch, copy->bytes);
+    }
+}
 
+// the rows carry the corners of the columns just received
+void progressHalo(struct halo *halo){
+    if (!halo->collective || halo->phase == 1) return;
 
+    MPI_Wait(&halo->requests[0], MPI_STATUS_IGNORE);
+    halo->phase = 1;
+    start_collective(halo, 1);
+}
 
-    MPI_Irecv(up_buffer,         width, MPI_INT, id_up ,        Direction.DOWN,       MPI_COMM_WORLD, &(*rHandlerUp));
-    MPI_Irecv(down_buffer,       width, MPI_INT, id_down,       Direction.UP,         MPI_COMM_WORLD, &(*rHandlerDown));
-    MPI_Irecv(left_buffer,       width, MPI_INT, id_left,       Direction.RIGHT,      MPI_COMM_WORLD, &(*rHandlerLeft));
-    MPI_Irecv(right_buffer,      width, MPI_INT, id_right,      Direction.LEFT,       MPI_COMM_WORLD, &(*rHandlerRight));
-    MPI_Irecv(up_left_buffer,    1,     MPI_INT, id_up_left,    Direction.DOWN_RIGHT, MPI_COMM_WORLD, &(*rHandlerUpLeft));
-    MPI_Irecv(up_right_buffer,   1,     MPI_INT, id_up_right,   Direction.DOWN_LEFT,  MPI_COMM_WORLD, &(*rHandlerUpRight));
-    MPI_Irecv(down_left_buffer,  1,     MPI_INT, id_down_left,  Direction.UP_RIGHT,   MPI_COMM_WORLD, &(*rHandlerDownLeft));
-    MPI_Irecv(down_right_buffer, 1,     MPI_INT, id_down_right, Direction.UP_LEFT,    MPI_COMM_WORLD, &(*rHandlerDownRight));
+void finishHalo(struct halo *halo){
+    if (halo->collective){
+        progressHalo(halo);
+        MPI_Wait(&halo->requests[0], MPI_STATUS_IGNORE);
+        return;
+    }
+
+    MPI_Waitall(halo->messages, halo->requests, MPI_STATUSES_IGNORE);
 
+    // and nobody writes its edges again before all the neighbours have copied them
+    if (halo->window != MPI_WIN_NULL) MPI_Barrier(Grid.node);
+}
+
+void freeHalo(struct halo *halo){
+    int i;
+    for (i = 0; i < 16; i++){
+        if (halo->requests[i] != MPI_REQUEST_NULL) MPI_Request_free(&halo->requests[i]);
+    }
+    if (halo->row    != MPI_DATATYPE_NULL) MPI_Type_free(&halo->row);
+    if (halo->column != MPI_DATATYPE_NULL) MPI_Type_free(&halo->column);
+    if (halo->corner != MPI_DATATYPE_NULL) MPI_Type_free(&halo->corner);
+    if (halo->band   != MPI_DATATYPE_NULL) MPI_Type_free(&halo->band);
 }
 
 void sendLocalStateToMaster(int *temp, int size){
@@ -468,45 +1199,76 @@ void sendLocalStateToMaster(int *temp, int size){
 }
 
 
-void receiveAllStates(int numprocs,int ***in, int width) {
-    int i;
-    int line, column;
+// the buffers of the other blocks are allocated once, by the caller
+void receiveAllStates(int ***in) {
+    int i, numprocs, size;
+    int coords[2];
 
+    MPI_Comm_size(Grid.comm, &numprocs);
 
     for (i=1; i<numprocs; i++){
-        line=i/(int) sqrt(numprocs);
-        column=mod(i,(int) sqrt(numprocs));
+        MPI_Cart_coords(Grid.comm, i, 2, coords);
+        size = blockRows(coords[0]) * blockCols(coords[1]);
 
-        in[line][column]=malloc(sizeof (int)*width*width);
+        MPI_Recv(in[coords[0]][coords[1]],size,MPI_INT,i,TAG_PRINT,MPI_COMM_WORLD,MPI_STATUS_IGNORE);
+
+    }
+}
 
-        MPI_Recv(in[line][column],width*width,MPI_INT,i,TAG_PRINT,MPI_COMM_WORLD,MPI_STATUS_IGNORE);
 
+// A process packs the bytes that start in its block (column 8b is its own), so the last of them needs the first
+// few columns of the right neighbour, which the blocks being at least 8 columns wide keeps to a single neighbour.
+unsigned char *packBlockBytes(struct subboard block, int msb_first, int *byte0, int *width){
+    int end = Grid.col0 + Grid.cols;
+    int give = (Grid.col0 == 0) ? 0 : (8 - Grid.col0 % 8) % 8;      // columns the left neighbour needs
+    int take = (end == Params.Cols) ? 0 : (8 - end % 8) % 8;          // columns needed from the right one
+    int row, col, c, cell, bit;
+    struct region left = {0, Grid.rows, 0, give};
+    int *out   = malloc(sizeof(int) * Grid.rows * (give > 0 ? give : 1));
+    int *in    = malloc(sizeof(int) * Grid.rows * (take > 0 ? take : 1));
+    int *cells = malloc(sizeof(int) * Grid.cols);
+    unsigned char *bytes;
+
+    *byte0 = (Grid.col0 + 7) / 8;
+    *width = (end + 7) / 8 - *byte0;
+    bytes  = calloc((size_t) Grid.rows * (*width > 0 ? *width : 1), 1);
+
+    if (give > 0) block.getRegion(block.board, left, out);
+    MPI_Sendrecv(out, Grid.rows * give, MPI_INT, Grid.id_left,  TAG_PACK,
+                 in,  Grid.rows * take, MPI_INT, Grid.id_right, TAG_PACK, Grid.comm, MPI_STATUS_IGNORE);
+
+    for (row = 0; row < Grid.rows; row++){
+        getSubboardRow(block, row, cells);
+        for (c = 8 * *byte0; c < 8 * (*byte0 + *width) && c < Params.Cols; c++){
+            col  = c - Grid.col0;
+            cell = col < Grid.cols ? cells[col] : in[row * take + col - Grid.cols];
+            bit  = msb_first ? 7 - c % 8 : c % 8;
+            bytes[(size_t) row * *width + c / 8 - *byte0] |= (unsigned char) (cell << bit);
+        }
     }
+
+    free(out);
+    free(in);
+    free(cells);
+    return bytes;
 }
 
-void finalizeCommunications(MPI_Request *sHandlerUp, MPI_Request *sHandlerDown, MPI_Request *sHandlerLeft, MPI_Request *sHandlerRight,
-                            MPI_Request *sHandlerUpLeft, MPI_Request *sHandlerUpRight, MPI_Request *sHandlerDownLeft, MPI_Request *sHandlerDownRight,
-                            MPI_Request *rHandlerUp, MPI_Request *rHandlerDown, MPI_Request *rHandlerLeft, MPI_Request *rHandlerRight,
-                            MPI_Request *rHandlerUpLeft, MPI_Request *rHandlerUpRight, MPI_Request *rHandlerDownLeft, MPI_Request *rHandlerDownRight){
 
-    MPI_Status status;
+static void get_int_region(const void *board, struct region region, int *out){
+    const int *block = board;
+    int row, width = region.col_to - region.col_from;
 
-    MPI_Wait(&(*sHandlerUp),        &status);
-    MPI_Wait(&(*sHandlerDown),      &status);
-    MPI_Wait(&(*sHandlerLeft),      &status);
-    MPI_Wait(&(*sHandlerRight),     &status);
-    MPI_Wait(&(*sHandlerUpLeft),    &status);
-    MPI_Wait(&(*sHandlerUpRight),   &status);
-    MPI_Wait(&(*sHandlerDownLeft),  &status);
-    MPI_Wait(&(*sHandlerDownRight), &status);
+    for (row = region.row_from; row < region.row_to; row++, out += width){
+        memcpy(out, &block[(size_t) row * Grid.cols + region.col_from], sizeof(int) * width);
+    }
+}
 
-    MPI_Wait(&(*rHandlerUp),        &status);
-    MPI_Wait(&(*rHandlerDown),      &status);
-    MPI_Wait(&(*rHandlerLeft),      &status);
-    MPI_Wait(&(*rHandlerRight),     &status);
-    MPI_Wait(&(*rHandlerUpLeft),    &status);
-    MPI_Wait(&(*rHandlerUpRight),   &status);
-    MPI_Wait(&(*rHandlerDownLeft),  &status);
-    MPI_Wait(&(*rHandlerDownRight), &status);
+struct subboard intSubboard(const int *block){
+    struct subboard subboard = {block, get_int_region};
+    return subboard;
+}
 
-}
\ No newline at end of file
+void getSubboardRow(struct subboard block, int row, int *out){
+    struct region region = {row, row + 1, 0, Grid.cols};
+    block.getRegion(block.board, region, out);
+}
@@ -2,6 +2,7 @@
 #define _MY_LIB_H_
 
 #include <stdio.h>
+#include <stdint.h>
 #include "mpi.h"
 
 #define MASTER_PROC_ID 0
@@ -9,16 +10,152 @@
 #define EMPTY_SYMBOL '.'
 #define TAG_PRINT 23
 #define TAG_INIT 46
+#define TAG_PACK 69
 
+#define KERNEL_INT 0                  // one int per cell, the reference implementation
+#define KERNEL_PACKED 1               // one bit per cell, 64 cells per word operation
+#define KERNEL_SIMD 2                 // one byte per cell, a vector of cells per instruction
+#define KERNEL_TILED 3                // the simd kernel, only where something changed in the last generation
+#define KERNEL_FLAT 4                 // the CUDA version's kernel on the host, the whole board as one flat torus
+
+#define ISA_AUTO -1                   // instruction sets of the simd kernel, AUTO picks the best the cpu has
+#define ISA_SCALAR 0
+#define ISA_SSE2 1
+#define ISA_AVX2 2
+#define ISA_AVX512 3
 
 struct params{
     int Cols;
     int Rows;
+    int proc_rows;                    // shape of the process grid, use 0 to let MPI choose
+    int proc_cols;
     int max_iterations;               // use -1 for unlimited
     int should_print;
     int numthreads;                   // use -1 for default
     int alive_probability;           // use -1 for default
-} Params;
+    int alive_probability_to;        // last probability of the ensemble, alive_probability otherwise
+    int kernel;                      // one of the KERNEL_* values
+    int isa;                         // one of the ISA_* values
+    int halo_depth;                  // ghost cells on each side, the halos are exchanged every halo_depth generations
+    long long hashlife_generations;  // fast-forward the initial board with HashLife, use 0 for none
+    int hashlife_memory;             // megabytes of HashLife nodes
+    int hashlife_check;              // compare the final board with HashLife's
+    int max_period;                  // stop when the board repeats with at most this period, use 0 to not look
+    unsigned long long seed;         // of the initial board
+    int seed_given;                  // or restored from a checkpoint, otherwise the master's clock is used
+    int checkpoint_every;            // generations between two checkpoints, use 0 for none
+    const char *checkpoint_file;
+    const char *restart_file;        // checkpoint to start from, NULL to draw a new board
+    const char *pattern_file;        // pattern to start from, NULL to draw a new board
+    int pattern_col, pattern_row;    // where its top left corner goes
+    int snapshot_every;              // generations between two images of the board, use 0 for none
+    const char *snapshot_file;       // prefix of their names
+    int warmup_generations;          // played before the clock starts
+    const char *report_file;         // measures of the run are appended there, NULL for none
+    int rule_given;                  // otherwise a checkpoint or pattern may bring its own rule
+    const char *trace_file;          // Chrome trace of the phases, NULL for none
+    int preview_factor;              // print the board shrunk this many times with every image, use 0 for none
+    int bind_threads;                // bind every thread to a core
+    int shared_memory;               // neighbours on the same node read each other's boards instead of messaging
+    int balance_every;               // generations between two load measures, use 0 to keep the blocks in place
+    int imbalance;                   // the blocks move when the busiest process works this many % more than the mean
+    int ensemble;                    // seeds of every probability played as independent boards, use 0 for one game
+    int neighbourhood;               // exchange the halos with neighbourhood collectives instead of messages
+    const char *ensemble_file;       // results of the boards of the ensemble
+};
+
+extern struct params Params;
+
+// A Life-like rule: a dead cell with a number of alive neighbours in born comes alive, an alive one with a number in
+// survive stays alive, every other cell is dead in the next generation
+struct rule{
+    char name[24];                    // B3/S23 notation
+    unsigned born, survive;           // bit n is set for n alive neighbours
+    uint8_t next[2][16];              // next state from the current state and the number of alive neighbours (up to 8,
+                                      // padded to 16 for the byte shuffles of the simd kernel)
+};
+
+extern struct rule Rule;
+
+#define RULE_CONWAY_BORN 0x008        // B3/S23
+#define RULE_CONWAY_SURVIVE 0x00C
+
+// This is an (emulated) namespace for directions
+struct directions{
+    int UP,
+        DOWN,
+        LEFT,
+        RIGHT,
+        UP_LEFT,
+        UP_RIGHT,
+        DOWN_LEFT,
+        DOWN_RIGHT;
+};
+
+extern struct directions Direction;
+
+// The processes form a periodic proc_rows x proc_cols cartesian grid. Every process owns one block of the board;
+// when the board does not divide evenly the first blocks of each dimension get one more row/column. With --balance
+// the cuts between the blocks move during the game (see balance.h), the blocks of a process row always share their
+// rows and those of a process column their columns.
+struct grid{
+    MPI_Comm comm;                    // cartesian communicator, same ranks as MPI_COMM_WORLD
+    MPI_Comm node;                    // the processes of comm on this node, MPI_COMM_NULL without --shared-memory
+    MPI_Comm graph;                   // comm with the 4 direct neighbours as a distributed graph, MPI_COMM_NULL
+                                      // without --neighbourhood (see setupPaddedHalo)
+    int dims[2];                      // number of process rows and columns
+    int coords[2];                    // row and column of this process in the grid
+    int rows, cols;                   // size of this process' subboard
+    int row0, col0;                   // global position of its first cell
+    int *row_start, *col_start;       // first row of every process row and first column of every process column,
+                                      // followed by Params.Rows and Params.Cols
+    int id_up, id_down, id_left, id_right,
+        id_up_left, id_up_right, id_down_left, id_down_right;
+};
+
+extern struct grid Grid;
+
+// A ghost block copied straight from the board of a neighbour on the same node
+struct haloCopy{
+    char *to;
+    const char *from;
+    int rows;
+    size_t bytes;                     // per row
+    size_t to_pitch, from_pitch;      // bytes from one row to the next
+};
+
+// A halo exchange with the 8 neighbours, set up once for one board buffer and restarted every generation.
+// requests[0..7] receive into the ghost cells, requests[8..15] send the edges, both in Direction order, unless
+// some neighbours share the node and the board: then the first messages requests are the ones left to start.
+// With --neighbourhood only requests[0] is used, by the collective in flight.
+struct halo{
+    MPI_Request requests[16];
+    int messages;                     // requests started by startHalo
+    MPI_Datatype row, column, corner; // edge blocks of the board, MPI_DATATYPE_NULL when not needed
+    MPI_Win window;                   // of the board, MPI_WIN_NULL when it is not shared with the node
+    int copies;
+    struct haloCopy copy[8];          // ghost blocks read from the neighbours on the node
+    MPI_Datatype band;                // depth whole padded rows, corners included
+    int collective;                   // exchanged with two neighbourhood collectives over Grid.graph
+    int phase;                        // of the collective in flight
+    int round;                        // parity of the sparse exchanges, their tags alternate
+    MPI_Aint displs[2][4];            // [send, receive][neighbour], addresses of the blocks
+    MPI_Datatype types[2][4];
+};
+
+// A rectangle of a padded subboard, [row_from, row_to) x [col_from, col_to) in padded coordinates
+struct region{
+    int row_from, row_to;
+    int col_from, col_to;
+};
+
+// The subboard of this process as the files read it, a few rows at a time: a block of Grid.rows x Grid.cols ints,
+// or the board of the engine of the game (see engine.h), so that the game needs no int copy of its board
+struct subboard{
+    const void *board;
+    void (*getRegion)(const void *board, struct region region, int *out);   // 0/1 ints row after row, the region in
+                                                                            // subboard coordinates
+};
 
 
 
@@ -27,53 +164,91 @@ int I_AM_MASTER(int myid);
 int I_AM_SLAVE(int myid);
 int mod(int a, int b);
 
+int blockSize(int n, int parts, int i);                              // size of the i-th of parts nearly equal blocks of n
+int blockStart(int n, int parts, int i);                             // first index of that block
+int blockRows(int i);                                                // rows of the blocks of process row i
+int blockCols(int j);                                                // columns of the blocks of process column j
+int blockRow0(int i);                                                // their first row
+int blockCol0(int j);                                                // their first column
+
 void parseCommandLineArguments(int argc, char* argv[]);
+int parseRule(const char *text, struct rule *rule);                 // B3/S23 or S/B (23/3) notation, returns 0 if invalid
+void setupGrid(int numprocs);                                        // build the process grid and this process' block
+void collectiveError(const char *format, ...);                       // collective: every process detected the same
+                                                                     // error, the master reports it and all of them exit
 
 // game ruling functions
-void printState(int numprocs, int width, int *** board);                                  // prints current state of the board
-void initializeBoard(int *subboard, int dimX, int dimY, int prob);                                  // place creatures on the board
+void printState(int *** board);                                                            // prints current state of the board
+void initializeBoard(int *subboard, int rows, int cols, int row0, int col0, int prob, unsigned long long seed);   // place creatures on the subboard at (row0, col0)
 
-void receiveAllStates(int numprocs,int ***in, int width);                                 // get all subtables for printing
+void receiveAllStates(int ***in);                                                          // get all subtables for printing
 
-// get the number of alive neighbours of a specific cell
-int countNeighboursOuter(int i, const int *temp, int width, int *up_buffer,
-                                                 int *down_buffer,
-                                                 int *left_buffer,
-                                                 int *right_buffer,
-                                                 int up_left_buffer,
-                                                 int up_right_buffer,
-                                                 int down_left_buffer,
-                                                 int down_right_buffer);
-int countNeighboursInner(int i, const int *temp, int width);
+// Collective. The subboard packed one bit per cell into the bytes of its rows of the board (column c is bit c % 8 of
+// byte c / 8, counted from the low bit or with msb_first from the high one, rows padded to whole bytes), as far as
+// they start in the block: returns Grid.rows x *width bytes, *byte0 is the first one's index in a row.
+// Blocks must be at least 8 columns wide.
+unsigned char *packBlockBytes(struct subboard block, int msb_first, int *byte0, int *width);
+struct subboard intSubboard(const int *block);                      // of a Grid.rows x Grid.cols block of ints
+void getSubboardRow(struct subboard block, int row, int *out);     // its Grid.cols ints of a row
 
+// With depth ghost cells on each side the halos are valid for depth generations: step s (0 .. depth-1) after an exchange
+// recomputes a region that shrinks by one cell per step, until only the subboard itself is left.
+struct region stepRegion(int rows, int cols, int depth, int step);
+struct region innerRegion(int rows, int cols, int depth);            // cells of step 0 that need no ghost cells
+int frameRegions(struct region outer, struct region inner, struct region strips[4]);   // outer minus inner, returns the count
 
-int isOuter(int i, int width);
+// Schedule of the parallel kernels: every thread of the team of a game loop computes one band of consecutive rows of
+// a region, and walks it in blocks of columns narrow enough for the rows around a cell to stay in its L2 cache. The
+// boards are first touched band by band as well, so that on NUMA nodes the pages of a band sit next to the thread
+// computing it. Outside of a team the band is the whole region.
+#ifndef BLOCK_BYTES
+#define BLOCK_BYTES (256 * 1024)      // cache a column block is sized for
+#endif
+#define BLOCK_COLUMNS(cell_size) (BLOCK_BYTES / (4 * (cell_size)))      // three rows read and one written
 
+struct region threadBand(struct region region);                      // the rows of a region the calling thread computes
+void touchRows(void *cells, size_t row_size, int rows);              // zero a board band by band, with the full team
 
+// get the number of alive neighbours of a specific cell of a padded subboard
+int countNeighbours(int i, const int *temp, int pitch);
 
-int updateLocalState(const int *sums, int *temp, int width);         // change local subtable to next state
+// Write the next state of the calling thread's band of a region (padded coordinates) of cur to next, returns whether
+// any of its cells changed
+int evolveIntBand(const int *cur, int *next, int pitch, struct region region);
 int checkGlobalStateChanged(int myState);                            // check if at least one process had a change
+
+uint64_t mixHash(uint64_t x);                                        // bijective scrambling of 64 bits (splitmix64 finalizer)
+uint64_t hashCells(uint64_t hash, const void *data, size_t size);    // continue a hash over size bytes
+
+// The hash of a subboard is the XOR of the hashes of pieces of its rows, cut at the columns 1 and cols-1 where the
+// inner region of a generation ends (see innerRegion): every piece is written by a single step of a generation, so
+// the threads can hash the pieces they just wrote, in any order, instead of the master hashing the whole board.
+int hashPieces(int rows, int cols, int depth, struct region region, struct region pieces[3]);   // the pieces of the
+                                                                     // subboard inside a region, returns their count
+uint64_t pieceSeed(int row, int col);                                // where the hash of the piece at (row, col) starts
+uint64_t hashPaddedBand(const void *board, int cell_size, int rows, int cols, int pitch, int depth, struct region region);   // pieces inside a region
+uint64_t hashPaddedBoard(const void *board, int cell_size, int rows, int cols, int pitch, int depth);   // cells of a padded subboard
+
 void sendLocalStateToMaster(int *temp, int size);
-void sendPeripheralsToNeighbours(int myid, int *temp, int width, int numprocs,
-                                 MPI_Request *sHandlerUp, MPI_Request *sHandlerDown, MPI_Request *sHandlerLeft, MPI_Request *sHandlerRight,
-                                 MPI_Request *sHandlerUpLeft, MPI_Request *sHandlerUpRight, MPI_Request *sHandlerDownLeft, MPI_Request *sHandlerDownRight);
-
-void receivePeripheralsFromNeighbours(int myid, int width, int numprocs, int *up_buffer,
-                                                                         int *down_buffer,
-                                                                         int *left_buffer,
-                                                                         int *right_buffer,
-                                                                         int *up_left_buffer,
-                                                                         int *up_right_buffer,
-                                                                         int *down_left_buffer,
-                                                                         int *down_right_buffer,
-                                      MPI_Request *rHandlerUp, MPI_Request *rHandlerDown, MPI_Request *rHandlerLeft, MPI_Request *rHandlerRight,
-                                      MPI_Request *rHandlerUpLeft, MPI_Request *rHandlerUpRight, MPI_Request *rHandlerDownLeft, MPI_Request *rHandlerDownRight);
-
-void finalizeCommunications(MPI_Request *sHandlerUp, MPI_Request *sHandlerDown, MPI_Request *sHandlerLeft, MPI_Request *sHandlerRight,
-                            MPI_Request *sHandlerUpLeft, MPI_Request *sHandlerUpRight, MPI_Request *sHandlerDownLeft, MPI_Request *sHandlerDownRight,
-                            MPI_Request *rHandlerUp, MPI_Request *rHandlerDown, MPI_Request *rHandlerLeft, MPI_Request *rHandlerRight,
-                            MPI_Request *rHandlerUpLeft, MPI_Request *rHandlerUpRight, MPI_Request *rHandlerDownLeft, MPI_Request *rHandlerDownRight
-);
+
+// halo exchange of a subboard padded with depth ghost cells on each side ((rows+2*depth) x pitch elements of type cell),
+// the neighbours' edges are received straight into the padding. With a window (see allocateSharedBoard, MPI_WIN_NULL
+// for none) the edges of the neighbours on the node are copied from their boards, and only the others are messages.
+// With Grid.graph the columns go to the left and right neighbours in one collective, then whole padded rows, with the
+// corners just received, to the ones above and below in another: 8 messages instead of 16. progressHalo starts the
+// rows once the columns are in, so that they travel while the threads compute the rest of the inner region.
+void setupPaddedHalo(struct halo *halo, void *board, MPI_Win window, MPI_Datatype cell, int rows, int cols, int pitch, int depth);
+void setupHaloTypes(struct halo *halo, MPI_Datatype cell, int rows, int cols, int pitch, int depth);   // datatypes only, no requests
+void clearHalo(struct halo *halo);                                   // no datatypes, requests or copies yet
+
+// exchange of a subboard padded with one ghost cell, where only the edges flagged in changed are sent (in request order)
+// and nothing at all goes out for the others; received tells which of the ghost edges were overwritten
+void startSparseHalo(struct halo *halo, void *board, MPI_Datatype cell, int rows, int cols, int pitch, const int changed[8]);
+void finishSparseHalo(struct halo *halo, void *board, MPI_Datatype cell, int rows, int cols, int pitch, int received[8]);
+void startHalo(struct halo *halo);                                   // post all the sends and receives
+void progressHalo(struct halo *halo);                                // move a two-phase exchange on to its second phase
+void finishHalo(struct halo *halo);                                  // wait until all of them complete
+void freeHalo(struct halo *halo);
 
 
 
@@ -0,0 +1,414 @@
+#include <stdlib.h>  /* for malloc/free */
+#include <string.h>
+
+#include "lib.h"
+#include "packed.h"
+#include "engine.h"
+#include "pages.h"
+#include "timing.h"
+
+
+// Auxiliary functions for addressing bits of the padded board
+static uint64_t *packed_row(uint64_t *cells, const struct packedBoard *board, int row){
+    return cells + (size_t) row * board->pitch;
+}
+
+static int get_bit(const uint64_t *row, int pos){
+    return (row[pos / WORD_BITS] >> (pos % WORD_BITS)) & 1;
+}
+
+static void set_bit(uint64_t *row, int pos, int value){
+    uint64_t mask = (uint64_t) 1 << (pos % WORD_BITS);
+    if (value){
+        row[pos / WORD_BITS] |= mask;
+    }else{
+        row[pos / WORD_BITS] &= ~mask;
+    }
+}
+
+// Bits of word j that lie in padded columns [from, to)
+static uint64_t bit_mask(int j, int from, int to){
+    int lo = from - j * WORD_BITS, hi = to - j * WORD_BITS;
+    uint64_t mask = ~(uint64_t) 0;
+
+    if (lo >= WORD_BITS || hi <= 0) return 0;
+    if (lo > 0)         mask &= ~(uint64_t) 0 << lo;
+    if (hi < WORD_BITS) mask &= ((uint64_t) 1 << hi) - 1;
+    return mask;
+}
+
+// Copy a block of height x width cells starting at (row, col) of the padded board to consecutive bits of buf, and back
+static void pack_block(const struct packedBoard *board, int row, int col, int height, int width, uint64_t *buf){
+    int r, c;
+
+    memset(buf, 0, (size_t) ((height * width + WORD_BITS - 1) / WORD_BITS) * sizeof(uint64_t));
+    for (r = 0; r < height; r++){
+        for (c = 0; c < width; c++){
+            set_bit(buf, r * width + c, get_bit(packed_row(board->cells, board, row + r), col + c));
+        }
+    }
+}
+
+static void unpack_block(struct packedBoard *board, int row, int col, int height, int width, const uint64_t *buf){
+    int r, c;
+
+    for (r = 0; r < height; r++){
+        for (c = 0; c < width; c++){
+            set_bit(packed_row(board->cells, board, row + r), col + c, get_bit(buf, r * width + c));
+        }
+    }
+}
+
+
+void allocatePackedBoard(struct packedBoard *board, int rows, int cols, int depth){
+
+    board->rows  = rows;
+    board->cols  = cols;
+    board->depth = depth;
+    board->pitch = (cols + 2 * depth + WORD_BITS - 1) / WORD_BITS;
+    board->edge_words   = (rows  * depth + WORD_BITS - 1) / WORD_BITS;
+    board->corner_words = (depth * depth + WORD_BITS - 1) / WORD_BITS;
+
+    board->cells       = allocateBoard((size_t) (rows + 2 * depth) * board->pitch * sizeof(uint64_t));
+    board->next        = allocateBoard((size_t) (rows + 2 * depth) * board->pitch * sizeof(uint64_t));
+    board->left_out    = calloc(board->edge_words, sizeof(uint64_t));
+    board->right_out   = calloc(board->edge_words, sizeof(uint64_t));
+    board->left_in     = calloc(board->edge_words, sizeof(uint64_t));
+    board->right_in    = calloc(board->edge_words, sizeof(uint64_t));
+    board->corners_out = calloc(4 * board->corner_words, sizeof(uint64_t));
+    board->corners_in  = calloc(4 * board->corner_words, sizeof(uint64_t));
+    touchRows(board->cells, board->pitch * sizeof(uint64_t), rows + 2 * depth);
+    touchRows(board->next,  board->pitch * sizeof(uint64_t), rows + 2 * depth);
+}
+
+void freePackedBoard(struct packedBoard *board){
+    freeBoard(board->cells, (size_t) (board->rows + 2 * board->depth) * board->pitch * sizeof(uint64_t));
+    freeBoard(board->next,  (size_t) (board->rows + 2 * board->depth) * board->pitch * sizeof(uint64_t));
+    free(board->left_out);
+    free(board->right_out);
+    free(board->left_in);
+    free(board->right_in);
+    free(board->corners_out);
+    free(board->corners_in);
+}
+
+
+void packRegion(struct packedBoard *board, struct region region, const int *in){
+    uint64_t *dst;
+    int row, col;
+
+    for (row = region.row_from; row < region.row_to; row++){
+        dst = packed_row(board->cells, board, row + board->depth);
+        for (col = region.col_from; col < region.col_to; col++) set_bit(dst, col + board->depth, *in++);
+    }
+}
+
+void unpackRegion(const struct packedBoard *board, struct region region, int *out){
+    const uint64_t *src;
+    int row, col;
+
+    for (row = region.row_from; row < region.row_to; row++){
+        src = packed_row(board->cells, board, row + board->depth);
+        for (col = region.col_from; col < region.col_to; col++) *out++ = get_bit(src, col + board->depth);
+    }
+}
+
+
+// Pack the edge columns and corners into contiguous buffers, so that each one goes out as a single message
+void collectPackedPeripherals(struct packedBoard *board){
+    int k = board->depth, rows = board->rows, cols = board->cols, n = board->corner_words;
+
+    pack_block(board, k,    k,    rows, k, board->left_out);
+    pack_block(board, k,    cols, rows, k, board->right_out);
+
+    pack_block(board, k,    k,    k, k, board->corners_out);
+    pack_block(board, k,    cols, k, k, board->corners_out + n);
+    pack_block(board, rows, k,    k, k, board->corners_out + 2 * n);
+    pack_block(board, rows, cols, k, k, board->corners_out + 3 * n);
+}
+
+
+void setupPackedHalo(struct halo *halo, struct packedBoard *board, uint64_t *cells){
+
+    int k = board->depth, rows = board->rows, edge = board->edge_words, n = board->corner_words;
+    int stripe = k * board->pitch;          // k whole rows
+    MPI_Request *r = halo->requests, *s = halo->requests + 8;
+
+    clearHalo(halo);
+
+    MPI_Recv_init(packed_row(cells, board, 0),        stripe, MPI_UINT64_T, Grid.id_up,         Direction.DOWN,       Grid.comm, &r[0]);
+    MPI_Recv_init(packed_row(cells, board, rows + k), stripe, MPI_UINT64_T, Grid.id_down,       Direction.UP,         Grid.comm, &r[1]);
+    MPI_Recv_init(board->left_in,                     edge,   MPI_UINT64_T, Grid.id_left,       Direction.RIGHT,      Grid.comm, &r[2]);
+    MPI_Recv_init(board->right_in,                    edge,   MPI_UINT64_T, Grid.id_right,      Direction.LEFT,       Grid.comm, &r[3]);
+    MPI_Recv_init(board->corners_in,                  n,      MPI_UINT64_T, Grid.id_up_left,    Direction.DOWN_RIGHT, Grid.comm, &r[4]);
+    MPI_Recv_init(board->corners_in + n,              n,      MPI_UINT64_T, Grid.id_up_right,   Direction.DOWN_LEFT,  Grid.comm, &r[5]);
+    MPI_Recv_init(board->corners_in + 2 * n,          n,      MPI_UINT64_T, Grid.id_down_left,  Direction.UP_RIGHT,   Grid.comm, &r[6]);
+    MPI_Recv_init(board->corners_in + 3 * n,          n,      MPI_UINT64_T, Grid.id_down_right, Direction.UP_LEFT,    Grid.comm, &r[7]);
+
+    // whole rows are sent, the ghost bits they carry are overwritten by the corner messages on arrival
+    MPI_Send_init(packed_row(cells, board, k),        stripe, MPI_UINT64_T, Grid.id_up,         Direction.UP,         Grid.comm, &s[0]);
+    MPI_Send_init(packed_row(cells, board, rows),     stripe, MPI_UINT64_T, Grid.id_down,       Direction.DOWN,       Grid.comm, &s[1]);
+    MPI_Send_init(board->left_out,                    edge,   MPI_UINT64_T, Grid.id_left,       Direction.LEFT,       Grid.comm, &s[2]);
+    MPI_Send_init(board->right_out,                   edge,   MPI_UINT64_T, Grid.id_right,      Direction.RIGHT,      Grid.comm, &s[3]);
+    MPI_Send_init(board->corners_out,                 n,      MPI_UINT64_T, Grid.id_up_left,    Direction.UP_LEFT,    Grid.comm, &s[4]);
+    MPI_Send_init(board->corners_out + n,             n,      MPI_UINT64_T, Grid.id_up_right,   Direction.UP_RIGHT,   Grid.comm, &s[5]);
+    MPI_Send_init(board->corners_out + 2 * n,         n,      MPI_UINT64_T, Grid.id_down_left,  Direction.DOWN_LEFT,  Grid.comm, &s[6]);
+    MPI_Send_init(board->corners_out + 3 * n,         n,      MPI_UINT64_T, Grid.id_down_right, Direction.DOWN_RIGHT, Grid.comm, &s[7]);
+}
+
+
+void storePackedPeripherals(struct packedBoard *board){
+    int k = board->depth, rows = board->rows, cols = board->cols, n = board->corner_words;
+
+    unpack_block(board, k,        0,        rows, k, board->left_in);
+    unpack_block(board, k,        cols + k, rows, k, board->right_in);
+
+    unpack_block(board, 0,        0,        k, k, board->corners_in);
+    unpack_block(board, 0,        cols + k, k, k, board->corners_in + n);
+    unpack_block(board, rows + k, 0,        k, k, board->corners_in + 2 * n);
+    unpack_block(board, rows + k, cols + k, k, k, board->corners_in + 3 * n);
+}
+
+
+// Next state of the 64 cells in word j of the given row, under the rule with the given born and survive sets.
+// The neighbours are counted with a tree of bitwise adders into the binary digits ones/twos/fours/eights.
+static inline __attribute__((always_inline))
+uint64_t evolve_word(const struct packedBoard *board, int row, int j, unsigned born, unsigned survive){
+    const uint64_t *up   = packed_row(board->cells, board, row - 1);
+    const uint64_t *mid  = packed_row(board->cells, board, row);
+    const uint64_t *down = packed_row(board->cells, board, row + 1);
+    int last = board->pitch - 1;
+
+    // west neighbours come from the bit below (carried in from the previous word), east ones from the bit above
+    uint64_t u  = up[j],   uw = (u << 1) | (j > 0 ? up[j-1] >> 63 : 0),   ue = (u >> 1) | (j < last ? up[j+1] << 63 : 0);
+    uint64_t m  = mid[j],  w  = (m << 1) | (j > 0 ? mid[j-1] >> 63 : 0),  e  = (m >> 1) | (j < last ? mid[j+1] << 63 : 0);
+    uint64_t d  = down[j], dw = (d << 1) | (j > 0 ? down[j-1] >> 63 : 0), de = (d >> 1) | (j < last ? down[j+1] << 63 : 0);
+
+    uint64_t s0, c0, s1, c1, s2, c2, ones, c3, t0, f0, twos, f1, fours, eights;
+
+    FULL_ADD(s0, c0, uw, u, ue);
+    FULL_ADD(s1, c1, dw, d, de);
+    HALF_ADD(s2, c2, w, e);
+    FULL_ADD(ones, c3, s0, s1, s2);     // every c* is worth two
+    FULL_ADD(t0, f0, c0, c1, c2);
+    HALF_ADD(twos, f1, t0, c3);         // every f* is worth four
+    fours  = f0 ^ f1;
+    eights = f0 & f1;
+
+    if (born == RULE_CONWAY_BORN && survive == RULE_CONWAY_SURVIVE){
+        // alive next: exactly 3 neighbours, or exactly 2 and alive now
+        return twos & ~fours & ~eights & (ones | m);
+    }
+
+    // born and survive both counts alive, whatever the cell
+    return countIn(born & survive, ones, twos, fours, eights)
+         | (countIn(born & ~survive, ones, twos, fours, eights) & ~m)
+         | (countIn(survive & ~born, ones, twos, fours, eights) & m);
+}
+
+
+// Whole words are computed, so bits just outside the region get a value as well; it is never read by a later
+// generation before the next exchange, and only the cells of the subboard inside the region count as changes.
+static inline __attribute__((always_inline))
+int evolve_region(struct packedBoard *board, struct region region, unsigned born, unsigned survive){
+    int row, j, block, end, flag = 0;
+    int k = board->depth;
+    int first = region.col_from / WORD_BITS, last = (region.col_to - 1) / WORD_BITS;
+    int from  = region.col_from > k ? region.col_from : k;
+    int to    = region.col_to < k + board->cols ? region.col_to : k + board->cols;
+    uint64_t result, mask, *dst;
+    struct region band = threadBand(region);
+    double busy = phaseClock();
+
+    if (region.row_from >= region.row_to || region.col_from >= region.col_to) return 0;
+
+    for (block = first; block <= last; block += BLOCK_COLUMNS(sizeof(uint64_t))){
+        end = (block + BLOCK_COLUMNS(sizeof(uint64_t)) <= last) ? block + BLOCK_COLUMNS(sizeof(uint64_t)) - 1 : last;
+        for (row = band.row_from; row < band.row_to; row++){
+            dst = packed_row(board->next, board, row);
+            for (j = block; j <= end; j++){
+                result = evolve_word(board, row, j, born, survive);
+                mask   = (row >= k && row < k + board->rows) ? bit_mask(j, from, to) : 0;
+                flag  |= ((result ^ packed_row(board->cells, board, row)[j]) & mask) != 0;
+                dst[j] = result;
+            }
+        }
+    }
+    lapThread(busy);
+    return flag;
+}
+
+// Region kernels compiled for the common rules, any other one reads its sets at run time
+#define RULE_KERNEL(name, born, survive) \
+    static int name(struct packedBoard *board, struct region region){ return evolve_region(board, region, born, survive); }
+
+RULE_KERNEL(evolve_conway,        RULE_CONWAY_BORN, RULE_CONWAY_SURVIVE)     // B3/S23
+RULE_KERNEL(evolve_highlife,      0x048,            RULE_CONWAY_SURVIVE)     // B36/S23
+RULE_KERNEL(evolve_day_and_night, 0x1C8,            0x1D8)                   // B3678/S34678
+RULE_KERNEL(evolve_seeds,         0x004,            0x000)                   // B2/S
+
+static const struct{
+    unsigned born, survive;
+    int (*evolve)(struct packedBoard *board, struct region region);
+} compiled_rules[] = {
+    {RULE_CONWAY_BORN, RULE_CONWAY_SURVIVE, evolve_conway},
+    {0x048,            RULE_CONWAY_SURVIVE, evolve_highlife},
+    {0x1C8,            0x1D8,               evolve_day_and_night},
+    {0x004,            0x000,               evolve_seeds},
+};
+
+
+int evolvePackedBand(struct packedBoard *board, struct region region){
+    size_t i;
+
+    for (i = 0; i < sizeof(compiled_rules) / sizeof(compiled_rules[0]); i++){
+        if (Rule.born == compiled_rules[i].born && Rule.survive == compiled_rules[i].survive) return compiled_rules[i].evolve(board, region);
+    }
+    return evolve_region(board, region, Rule.born, Rule.survive);
+}
+
+
+void swapPackedBoard(struct packedBoard *board){
+    uint64_t *temp = board->cells;
+    board->cells = board->next;
+    board->next  = temp;
+}
+
+
+uint64_t hashPackedBand(const struct packedBoard *board, const uint64_t *cells, struct region region){
+    struct region pieces[3];
+    int n = hashPieces(board->rows, board->cols, board->depth, region, pieces), i, row, j, first, last;
+    uint64_t hash = 0, line[board->pitch];
+    const uint64_t *src;
+
+    for (i = 0; i < n; i++){
+        first = pieces[i].col_from / WORD_BITS;
+        last  = (pieces[i].col_to - 1) / WORD_BITS;
+        for (row = pieces[i].row_from; row < pieces[i].row_to; row++){
+            src = packed_row((uint64_t *) cells, board, row);
+            for (j = first; j <= last; j++) line[j - first] = src[j] & bit_mask(j, pieces[i].col_from, pieces[i].col_to);
+            hash ^= hashCells(pieceSeed(row, pieces[i].col_from), line, sizeof(uint64_t) * (last - first + 1));
+        }
+    }
+    return hash;
+}
+
+uint64_t hashPackedBoard(const struct packedBoard *board){
+    struct region subboard = {board->depth, board->depth + board->rows, board->depth, board->depth + board->cols};
+    return hashPackedBand(board, board->cells, subboard);
+}
+
+
+// The packed kernel as an engine (see engine.h), with the exchange of each of its two buffers
+struct packedEngine{
+    struct packedBoard board;
+    struct halo halo[2];
+    int current;                      // halo of the buffer holding the current generation
+    struct rollingHash hash;
+    long long generations, cells;     // see engineStats
+};
+
+static void *packed_allocate(int rows, int cols, int depth){
+    struct packedEngine *engine = malloc(sizeof(struct packedEngine));
+
+    allocatePackedBoard(&engine->board, rows, cols, depth);
+    setupPackedHalo(&engine->halo[0], &engine->board, engine->board.cells);
+    setupPackedHalo(&engine->halo[1], &engine->board, engine->board.next);
+    engine->current     = 0;
+    engine->generations = 0;
+    engine->cells       = 0;
+    forgetRollingHash(&engine->hash);
+    return engine;
+}
+
+static void packed_free(void *board){
+    struct packedEngine *engine = board;
+
+    freeHalo(&engine->halo[0]);
+    freeHalo(&engine->halo[1]);
+    freePackedBoard(&engine->board);
+    free(engine);
+}
+
+static void packed_put_region(void *board, struct region region, const int *in){
+    struct packedEngine *engine = board;
+
+    packRegion(&engine->board, region, in);
+    forgetRollingHash(&engine->hash);
+}
+
+static void packed_get_region(const void *board, struct region region, int *out){
+    unpackRegion(&((const struct packedEngine *) board)->board, region, out);
+}
+
+static void packed_start_halo(void *board){
+    struct packedEngine *engine = board;
+
+    collectPackedPeripherals(&engine->board);
+    startHalo(&engine->halo[engine->current]);
+}
+
+static void packed_finish_halo(void *board){
+    struct packedEngine *engine = board;
+
+    finishHalo(&engine->halo[engine->current]);
+}
+
+static int packed_step(void *board, struct region region){
+    struct packedEngine *engine = board;
+    int flag;
+
+    countCells(&engine->cells, region);
+    flag = evolvePackedBand(&engine->board, region);
+    if (rollingHashes()) addBandHash(&engine->hash, hashPackedBand(&engine->board, engine->board.next, threadBand(region)));
+    return flag;
+}
+
+// The received edges go into words that also hold cells of the subboard, so they are stored only once no thread reads
+// the board for the inner region anymore. Words shared by a strip and the inner region are computed again, now that
+// their ghost cells are in place, and the left and right strips of a narrow subboard share words too.
+static int packed_frame(void *board, struct region outer, struct region inner){
+    struct packedEngine *engine = board;
+    struct region strips[4];
+    int i, n = frameRegions(outer, inner, strips), flag = 0;
+
+#pragma omp master
+    storePackedPeripherals(&engine->board);
+#pragma omp barrier
+
+    for (i = 0; i < n; i++){
+        flag |= packed_step(board, strips[i]);
+#pragma omp barrier
+    }
+    return flag;
+}
+
+static void packed_swap(void *board){
+    struct packedEngine *engine = board;
+
+    swapPackedBoard(&engine->board);
+    engine->current = 1 - engine->current;
+    engine->generations++;
+    swapRollingHash(&engine->hash);
+}
+
+static uint64_t packed_hash(void *board){
+    struct packedEngine *engine = board;
+
+    if (!engine->hash.known) setRollingHash(&engine->hash, hashPackedBoard(&engine->board));
+    return engine->hash.current;
+}
+
+static void packed_stats(const void *board, struct engineStats *stats){
+    const struct packedEngine *engine = board;
+    const struct packedBoard *cells = &engine->board;
+
+    stats->generations += engine->generations;
+    stats->cells       += engine->cells;
+    stats->bytes        = 2 * (long long) sizeof(uint64_t) * (cells->rows + 2 * cells->depth) * cells->pitch;
+}
+
+const struct engine PackedEngine = {
+    "packed", packed_allocate, packed_put_region, packed_get_region, NULL, packed_start_halo, NULL, packed_finish_halo,
+    packed_step, packed_frame, packed_swap, packed_hash, packed_stats, packed_free
+};
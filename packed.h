@@ -0,0 +1,68 @@
+#ifndef _PACKED_H_
+#define _PACKED_H_
+
+#include <stdint.h>
+#include "mpi.h"
+
+#include "lib.h"
+
+#define WORD_BITS 64
+
+// Bitwise adders: each bit position of the operands is an independent cell (of one board, or of 64 boards for the
+// ensemble)
+#define HALF_ADD(sum, carry, a, b)      do { (sum) = (a) ^ (b); (carry) = (a) & (b); } while (0)
+#define FULL_ADD(sum, carry, a, b, c)   do { uint64_t _t = (a) ^ (b); (sum) = _t ^ (c); (carry) = ((a) & (b)) | (_t & (c)); } while (0)
+
+// The cells of a word whose number of alive neighbours is in set (bit n for n neighbours), from its binary digits.
+// With a constant set the unused terms fold away.
+static inline __attribute__((always_inline))
+uint64_t countIn(unsigned set, uint64_t ones, uint64_t twos, uint64_t fours, uint64_t eights){
+    uint64_t low = ~fours & ~eights;
+
+    return ((set >> 0 & 1) ? ~ones & ~twos & low   : 0) | ((set >> 1 & 1) ? ones & ~twos & low   : 0)
+         | ((set >> 2 & 1) ? ~ones & twos & low    : 0) | ((set >> 3 & 1) ? ones & twos & low    : 0)
+         | ((set >> 4 & 1) ? ~ones & ~twos & fours : 0) | ((set >> 5 & 1) ? ones & ~twos & fours : 0)
+         | ((set >> 6 & 1) ? ~ones & twos & fours  : 0) | ((set >> 7 & 1) ? ones & twos & fours  : 0)
+         | ((set >> 8 & 1) ? eights : 0);
+}
+
+
+// A subboard stored with one bit per cell.
+// Every row is padded with depth ghost columns on each side (bits 0 .. depth-1 of the row are the left ghost cells,
+// bits cols+depth .. cols+2*depth-1 the right ones) and the board with depth ghost rows above and below, so a cell
+// of row r, column c lives at bit (c+depth) of row (r+depth).
+struct packedBoard{
+    int rows;
+    int cols;
+    int depth;                        // ghost cells on each side
+    int pitch;                        // words per row, ghost columns included
+    int edge_words, corner_words;     // size of an edge / corner buffer
+    uint64_t *cells;                  // current generation, (rows+2*depth) * pitch words
+    uint64_t *next;                   // next generation is written here, then the two are swapped
+    uint64_t *left_out, *right_out;   // edge columns packed for sending, depth bits per row
+    uint64_t *left_in,  *right_in;    // edge columns received from the left/right neighbours
+    uint64_t *corners_out;            // up-left, up-right, down-left, down-right blocks of depth x depth bits
+    uint64_t *corners_in;
+};
+
+
+void allocatePackedBoard(struct packedBoard *board, int rows, int cols, int depth);
+void freePackedBoard(struct packedBoard *board);
+
+void packRegion(struct packedBoard *board, struct region region, const int *in);      // store 0/1 ints, row after row
+void unpackRegion(const struct packedBoard *board, struct region region, int *out);   // load them
+
+void setupPackedHalo(struct halo *halo, struct packedBoard *board, uint64_t *cells);   // exchange for one of the two buffers
+void collectPackedPeripherals(struct packedBoard *board);                // pack the edges to be sent
+void storePackedPeripherals(struct packedBoard *board);                  // move received edges into the ghost cells
+
+// next state of the words covering the calling thread's band of a region (in padded bit columns), returns whether a
+// cell of the subboard changed
+int evolvePackedBand(struct packedBoard *board, struct region region);
+void swapPackedBoard(struct packedBoard *board);                         // make the next generation the current one
+uint64_t hashPackedBand(const struct packedBoard *board, const uint64_t *cells, struct region region);   // of one of the
+                                                                         // buffers, pieces inside a region (see hashPieces)
+uint64_t hashPackedBoard(const struct packedBoard *board);               // hash of the cells of the subboard
+
+
+#endif
@@ -0,0 +1,102 @@
+#define _GNU_SOURCE                   // for MAP_ANONYMOUS, MAP_HUGETLB and MADV_HUGEPAGE
+#include <stdlib.h>  /* for posix_memalign/free */
+#include <stdint.h>
+#include <sys/mman.h>
+
+#include "lib.h"
+#include "pages.h"
+
+
+static size_t huge_pages(size_t size){
+    return (size + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+}
+
+
+// normal pages starting on a huge page boundary, which the kernel may back with transparent huge pages
+static void *map_aligned(size_t length){
+    char *mapped, *aligned;
+    size_t head;
+
+    mapped = mmap(NULL, length + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mapped == MAP_FAILED) return NULL;
+
+    aligned = (char *) (((uintptr_t) mapped + HUGE_PAGE_SIZE - 1) & ~((uintptr_t) HUGE_PAGE_SIZE - 1));
+    head    = (size_t) (aligned - mapped);
+    if (head > 0) munmap(mapped, head);
+    if (head < HUGE_PAGE_SIZE) munmap(aligned + length, HUGE_PAGE_SIZE - head);
+
+#ifdef MADV_HUGEPAGE
+    madvise(aligned, length, MADV_HUGEPAGE);
+#endif
+    return aligned;
+}
+
+
+// In huge pages the boards line up on the same cache sets, and the rows a kernel reads and writes at the same time
+// evict each other: every board starts a few cache lines further into its first page than the previous one.
+#define STAGGER (17 * BOARD_ALIGNMENT)
+
+static int boards;                    // allocated so far
+
+
+void *allocateBoard(size_t size){
+    size_t offset = (size_t) (boards++ % 16) * STAGGER;
+    char *pages = NULL;
+    void *cells = NULL;
+    int myid;
+
+    if (size >= HUGE_PAGE_SIZE){
+#ifdef MAP_HUGETLB
+        pages = mmap(NULL, huge_pages(size + offset), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (pages == MAP_FAILED) pages = NULL;
+#endif
+        if (pages == NULL) pages = map_aligned(huge_pages(size + offset));
+        if (pages != NULL) cells = pages + offset;
+    }else if (posix_memalign(&cells, BOARD_ALIGNMENT, size > 0 ? size : 1) != 0){
+        cells = NULL;
+    }
+
+    if (cells == NULL){
+        MPI_Comm_rank(MPI_COMM_WORLD, &myid);
+        fprintf(stderr, "Process %d could not allocate %.1f MB for its board, try more processes or fewer cells.\n",
+                myid, size / 1048576.0);
+        MPI_Abort(MPI_COMM_WORLD, 2);
+    }
+    return cells;
+}
+
+void freeBoard(void *cells, size_t size){
+    char *pages = (char *) ((uintptr_t) cells & ~((uintptr_t) HUGE_PAGE_SIZE - 1));
+
+    if (cells == NULL) return;
+    if (size >= HUGE_PAGE_SIZE) munmap(pages, huge_pages(size + (size_t) ((char *) cells - pages)));
+    else free(cells);
+}
+
+
+void *allocateSharedBoard(size_t size, MPI_Win *window){
+    MPI_Info info;
+    void *cells;
+
+    *window = MPI_WIN_NULL;
+    if (Grid.node == MPI_COMM_NULL) return allocateBoard(size);
+
+    // every segment on the pages of its own process, which its threads then touch first
+    MPI_Info_create(&info);
+    MPI_Info_set(info, "alloc_shared_noncontig", "true");
+    MPI_Win_allocate_shared((MPI_Aint) size, 1, info, Grid.node, &cells, window);
+    MPI_Info_free(&info);
+
+    // a single passive epoch for the whole game, the halos only synchronise their memory
+    MPI_Win_lock_all(MPI_MODE_NOCHECK, *window);
+    return cells;
+}
+
+void freeSharedBoard(void *cells, size_t size, MPI_Win *window){
+    if (*window == MPI_WIN_NULL){
+        freeBoard(cells, size);
+        return;
+    }
+    MPI_Win_unlock_all(*window);
+    MPI_Win_free(window);
+}
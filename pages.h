@@ -0,0 +1,26 @@
+#ifndef _PAGES_H_
+#define _PAGES_H_
+
+#include <stddef.h>
+
+#include "lib.h"
+
+#define HUGE_PAGE_SIZE (2 << 20)      // boards at least this large go in huge pages
+#define BOARD_ALIGNMENT 64            // of the smaller ones, a cache line / widest vector
+
+
+// Storage of the boards on the heap, so that their size is only limited by the memory of the node. Boards of at
+// least a huge page are mapped in 2 MB pages to spare TLB misses: from the pool reserved by the system (MAP_HUGETLB)
+// when it has one, otherwise as transparent huge pages, otherwise in normal pages. The memory is left untouched for
+// the threads to place it (see touchRows). A process that cannot get the memory says so and aborts the run.
+void *allocateBoard(size_t size);
+void freeBoard(void *cells, size_t size);                            // the size it was allocated with
+
+// Collective over the processes of the node. With --shared-memory the board goes in a window of Grid.node, where the
+// neighbours on the node read its edges (see setupPaddedHalo), each process in its own normal pages. Otherwise it is
+// allocateBoard's, and *window is MPI_WIN_NULL.
+void *allocateSharedBoard(size_t size, MPI_Win *window);
+void freeSharedBoard(void *cells, size_t size, MPI_Win *window);
+
+
+#endif
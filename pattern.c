@@ -0,0 +1,330 @@
+#include <stdlib.h>  /* for malloc/free */
+#include <string.h>
+#include <ctype.h>
+
+#include "lib.h"
+#include "pattern.h"
+
+#define FORMAT_RLE 1
+#define FORMAT_LIFE106 2
+
+
+// what the master finds at the top of the file
+struct patternInfo{
+    int format;                       // one of the FORMAT_* values, 0 if unknown
+    long long data_start;             // offset of the cells
+    long long width, height;          // as the RLE header gives them
+    char rule[32];                    // of the RLE header, empty if none
+};
+
+// sequential reading of the file from any offset, one buffer at a time
+struct stream{
+    MPI_File file;
+    MPI_Offset size;                  // of the file
+    MPI_Offset offset;                // of buffer[0]
+    char *buffer;
+    int length, next;
+};
+
+// Runs of alive cells as (row, column, length) triples on the whole board, one list per destination process
+struct runs{
+    int *cells;
+    size_t count, capacity;           // in ints
+};
+
+// Where an RLE parser stands. Parsing a share of the file from zero gives its effect: the rows it moves down and the
+// column it ends at, which is relative when it did not start a new row; effects of consecutive shares combine.
+struct rleState{
+    long long row, col;
+    long long new_row;                // whether col is absolute
+    long long stopped;                // the ! at the end of the pattern was seen
+};
+
+
+static void open_stream(struct stream *s, MPI_File file, MPI_Offset from){
+    s->file   = file;
+    s->offset = from;
+    s->length = 0;
+    s->next   = 0;
+    s->buffer = malloc(PATTERN_BUFFER);
+    MPI_File_get_size(file, &s->size);
+}
+
+static MPI_Offset stream_offset(const struct stream *s){
+    return s->offset + s->next;
+}
+
+static int next_char(struct stream *s){
+    MPI_Offset left;
+
+    if (s->next == s->length){
+        s->offset += s->length;
+        left       = s->size - s->offset;
+        s->length  = left < PATTERN_BUFFER ? (int) left : PATTERN_BUFFER;
+        s->next    = 0;
+        if (s->length <= 0) { s->length = 0; return -1; }
+        MPI_File_read_at(s->file, s->offset, s->buffer, s->length, MPI_BYTE, MPI_STATUS_IGNORE);
+    }
+    return (unsigned char) s->buffer[s->next++];
+}
+
+// a line without its end of line, cut to size-1 characters; returns 0 at the end of the file
+static int read_line(struct stream *s, char *line, int size){
+    int c, n = 0;
+
+    while ((c = next_char(s)) != -1 && c != '\n'){
+        if (n < size - 1) line[n++] = (char) c;
+    }
+    if (n > 0 && line[n-1] == '\r') n--;
+    line[n] = '\0';
+    return c != -1 || n > 0;
+}
+
+
+static void read_info(MPI_File file, struct patternInfo *info){
+    struct stream s;
+    char line[256], *rule;
+
+    memset(info, 0, sizeof(*info));
+    open_stream(&s, file, 0);
+
+    if (!read_line(&s, line, sizeof(line))) { free(s.buffer); return; }
+    if (strncmp(line, "#Life 1.06", 10) == 0){
+        info->format = FORMAT_LIFE106;
+    }else{
+        // comments, then the x = W, y = H header line of RLE
+        while (line[0] == '#' || line[0] == '\0'){
+            if (!read_line(&s, line, sizeof(line))) { free(s.buffer); return; }
+        }
+        if (sscanf(line, " x = %lld , y = %lld", &info->width, &info->height) == 2) info->format = FORMAT_RLE;
+        rule = strstr(line, "rule");
+        if (rule != NULL) sscanf(rule, "rule = %31[^, ]", info->rule);
+    }
+    info->data_start = stream_offset(&s);
+    free(s.buffer);
+}
+
+
+// Index of the block that holds x, among parts blocks starting at start[0..parts-1]
+static int block_of(const int *start, int parts, int x){
+    int low = 0, high = parts - 1, middle;
+
+    while (low < high){
+        middle = (low + high + 1) / 2;
+        if (start[middle] <= x) low = middle;
+        else high = middle - 1;
+    }
+    return low;
+}
+
+static void push_run(struct runs *list, int row, int col, int length){
+    if (list->count + 3 > list->capacity){
+        list->capacity = 2 * list->capacity + 48;
+        list->cells    = realloc(list->cells, sizeof(int) * list->capacity);
+    }
+    list->cells[list->count++] = row;
+    list->cells[list->count++] = col;
+    list->cells[list->count++] = length;
+}
+
+// a run of the pattern, moved to its place on the board and cut where it crosses blocks (or wraps around)
+static void place_run(struct runs *out, long long row, long long col, long long length){
+    int r, c, piece, owner, end, coords[2];
+
+    r = mod((int) ((row + Params.pattern_row) % Params.Rows), Params.Rows);
+    c = mod((int) ((col + Params.pattern_col) % Params.Cols), Params.Cols);
+    if (length > Params.Cols) length = Params.Cols;
+
+    coords[0] = block_of(Grid.row_start, Grid.dims[0], r);
+    while (length > 0){
+        coords[1] = block_of(Grid.col_start, Grid.dims[1], c);
+        end       = blockCol0(coords[1]) + blockCols(coords[1]);
+        piece     = (end - c < length) ? end - c : (int) length;
+        MPI_Cart_rank(Grid.comm, coords, &owner);
+        push_run(&out[owner], r, c, piece);
+        length -= piece;
+        c       = (end == Params.Cols) ? 0 : end;
+    }
+}
+
+
+// Parse the RLE tokens whose tag lies in [from, end); the count of the first one may start a few digits earlier.
+// With out NULL only the state moves.
+static void parse_rle(struct stream *s, MPI_Offset end, struct rleState *at, struct runs *out){
+    long long count = 0;
+    int c;
+
+    while (!at->stopped && stream_offset(s) < end && (c = next_char(s)) != -1){
+        if (isdigit(c)){
+            count = 10 * count + (c - '0');
+            continue;
+        }
+        if (isspace(c)) continue;
+        if (count == 0) count = 1;
+
+        if (c == '$'){
+            at->row    += count;
+            at->col     = 0;
+            at->new_row = 1;
+        }else if (c == '!'){
+            at->stopped = 1;
+        }else{
+            // b and . are dead cells, any other state is alive
+            if (c != 'b' && c != '.' && out != NULL) place_run(out, at->row, at->col, count);
+            at->col += count;
+        }
+        count = 0;
+    }
+}
+
+// the state after a share that starts in state a and has effect b
+static void combine_rle(const struct rleState *a, struct rleState *b){
+    if (a->stopped){
+        *b = *a;
+    }else if (b->new_row){
+        b->row     += a->row;
+    }else{
+        b->row      = a->row;
+        b->col     += a->col;
+        b->new_row  = a->new_row;
+    }
+}
+
+static void combine_rle_op(void *in, void *inout, int *len, MPI_Datatype *type){
+    int i;
+    (void) type;
+
+    for (i = 0; i < *len; i++) combine_rle((struct rleState *) in + i, (struct rleState *) inout + i);
+}
+
+
+// Parse the lines that start in [from, end) of a Life 1.06 file, "x y" per alive cell
+static void parse_life106(struct stream *s, MPI_Offset end, struct runs *out){
+    char line[256];
+    long long x, y;
+
+    while (stream_offset(s) < end && read_line(s, line, sizeof(line))){
+        if (line[0] != '#' && sscanf(line, "%lld %lld", &x, &y) == 2) place_run(out, y, x, 1);
+    }
+}
+
+// Start of the first token or line of the share at from, which may begin inside one of the previous share
+static MPI_Offset share_start(MPI_File file, const struct patternInfo *info, MPI_Offset from){
+    char before[32];
+    int n, back;
+    struct stream s;
+
+    if (from == info->data_start) return from;
+
+    n = (from - info->data_start < (MPI_Offset) sizeof(before)) ? (int) (from - info->data_start) : (int) sizeof(before);
+    MPI_File_read_at(file, from - n, before, n, MPI_BYTE, MPI_STATUS_IGNORE);
+
+    if (info->format == FORMAT_RLE){
+        // the digits just before the share count its first tag
+        for (back = 0; back < n && isdigit((unsigned char) before[n - 1 - back]); back++);
+        return from - back;
+    }
+
+    // a line that started before belongs to the previous share
+    if (before[n - 1] == '\n') return from;
+    open_stream(&s, file, from);
+    while (next_char(&s) != '\n' && stream_offset(&s) < s.size);
+    from = stream_offset(&s);
+    free(s.buffer);
+    return from;
+}
+
+
+void loadPattern(const char *path, int *block){
+    struct patternInfo info;
+    struct rleState effect, at;
+    struct runs *out;
+    struct stream s;
+    MPI_File file;
+    MPI_Offset size, from, end;
+    MPI_Datatype state_type;
+    MPI_Op combine;
+    int myid, numprocs, i, j, total;
+    int *send_counts, *recv_counts, *send_displs, *recv_displs, *send, *recv;
+
+    MPI_Comm_rank(Grid.comm, &myid);
+    MPI_Comm_size(Grid.comm, &numprocs);
+    memset(block, 0, sizeof(int) * Grid.rows * Grid.cols);
+
+    if (MPI_File_open(Grid.comm, (char *) path, MPI_MODE_RDONLY, MPI_INFO_NULL, &file) != MPI_SUCCESS){
+        collectiveError("Could not open the pattern `%s'.\n", path);
+    }
+    if (I_AM_MASTER(myid)) read_info(file, &info);
+    MPI_Bcast(&info, sizeof(info), MPI_BYTE, MASTER_PROC_ID, Grid.comm);
+
+    if (info.format == 0) collectiveError("`%s' is neither an RLE nor a Life 1.06 pattern.\n", path);
+    if (!Params.rule_given && info.rule[0] != '\0' && !parseRule(info.rule, &Rule)) collectiveError("The rule of the pattern `%s' is unknown.\n", path);
+    if (info.width > Params.Cols || info.height > Params.Rows) collectiveError("The pattern `%s' is larger than the board.\n", path);
+
+    // every process takes an equal share of the bytes
+    MPI_File_get_size(file, &size);
+    from = info.data_start + (size - info.data_start) * myid / numprocs;
+    end  = info.data_start + (size - info.data_start) * (myid + 1) / numprocs;
+    from = share_start(file, &info, from);
+    if (myid + 1 < numprocs) end = share_start(file, &info, end);
+
+    out = calloc(numprocs, sizeof(struct runs));
+    open_stream(&s, file, from);
+    if (info.format == FORMAT_RLE){
+        // a first pass finds where every share starts on the board, the second one places its cells
+        memset(&effect, 0, sizeof(effect));
+        parse_rle(&s, end, &effect, NULL);
+
+        MPI_Type_contiguous(4, MPI_LONG_LONG, &state_type);
+        MPI_Type_commit(&state_type);
+        MPI_Op_create(combine_rle_op, 0, &combine);
+        MPI_Exscan(&effect, &at, 1, state_type, combine, Grid.comm);
+        MPI_Op_free(&combine);
+        MPI_Type_free(&state_type);
+        if (myid == 0) memset(&at, 0, sizeof(at));
+
+        free(s.buffer);
+        open_stream(&s, file, from);
+        parse_rle(&s, end, &at, out);
+    }else{
+        parse_life106(&s, end, out);
+    }
+    free(s.buffer);
+    MPI_File_close(&file);
+
+    // runs go to the processes owning their cells
+    send_counts = malloc(sizeof(int) * numprocs);
+    recv_counts = malloc(sizeof(int) * numprocs);
+    send_displs = malloc(sizeof(int) * numprocs);
+    recv_displs = malloc(sizeof(int) * numprocs);
+    for (i = 0, total = 0; i < numprocs; i++){
+        send_counts[i] = (int) out[i].count;
+        send_displs[i] = total;
+        total         += send_counts[i];
+    }
+    send = malloc(sizeof(int) * (total > 0 ? total : 1));
+    for (i = 0; i < numprocs; i++){
+        if (out[i].count > 0) memcpy(&send[send_displs[i]], out[i].cells, sizeof(int) * out[i].count);
+        free(out[i].cells);
+    }
+    free(out);
+
+    MPI_Alltoall(send_counts, 1, MPI_INT, recv_counts, 1, MPI_INT, Grid.comm);
+    for (i = 0, total = 0; i < numprocs; i++){
+        recv_displs[i] = total;
+        total         += recv_counts[i];
+    }
+    recv = malloc(sizeof(int) * (total > 0 ? total : 1));
+    MPI_Alltoallv(send, send_counts, send_displs, MPI_INT, recv, recv_counts, recv_displs, MPI_INT, Grid.comm);
+
+    for (i = 0; i < total; i += 3){
+        for (j = 0; j < recv[i+2]; j++) block[(recv[i] - Grid.row0) * Grid.cols + recv[i+1] - Grid.col0 + j] = 1;
+    }
+
+    free(send);
+    free(recv);
+    free(send_counts);
+    free(recv_counts);
+    free(send_displs);
+    free(recv_displs);
+}
@@ -0,0 +1,16 @@
+#ifndef _PATTERN_H_
+#define _PATTERN_H_
+
+#include "lib.h"
+
+#define PATTERN_BUFFER (1 << 20)      // bytes read at a time
+
+
+// Collective. Clear the subboard (Grid.rows x Grid.cols ints) and place the pattern of --pattern on the board, its
+// top left corner at the given column and row, wrapping around the edges. The file is either RLE or Life 1.06.
+// Every process parses its own share of the file and sends the runs of alive cells it finds to the processes owning
+// them, so the file never goes through a single process.
+void loadPattern(const char *path, int *block);
+
+
+#endif
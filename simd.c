@@ -0,0 +1,379 @@
+#include <stdlib.h>  /* for malloc/free */
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SIMD_X86
+#endif
+
+#include "lib.h"
+#include "simd.h"
+#include "engine.h"
+#include "pages.h"
+#include "timing.h"
+
+
+// A row kernel computes the next state of n consecutive cells of one row. up, mid and down point to the first
+// of those cells in the rows above, at and below it; the cells at index -1 and n are read but not written.
+// Returns whether any of the n cells changed.
+typedef int (*rowKernel)(const uint8_t *up, const uint8_t *mid, const uint8_t *down, uint8_t *out, int n);
+
+
+// Reference version, one cell at a time
+static int evolve_row_scalar(const uint8_t *up, const uint8_t *mid, const uint8_t *down, uint8_t *out, int n){
+    int i, sum, alive, flag = 0;
+
+    for (i = 0; i < n; i++){
+        sum = up[i-1]   + up[i]   + up[i+1]
+            + mid[i-1]            + mid[i+1]
+            + down[i-1] + down[i] + down[i+1];
+
+        alive   = Rule.next[mid[i]][sum];
+        flag   |= alive ^ mid[i];
+        out[i]  = (uint8_t) alive;
+    }
+    return flag;
+}
+
+
+#ifdef SIMD_X86
+
+// The vector versions add the eight shifted rows bytewise (a sum never exceeds 8) and look the next states up in
+// the born and survive tables of the rule with byte shuffles, then finish the last n % width cells with the scalar
+// version. SSE2 has no byte shuffle, it compares the sums with the numbers of neighbours the rule names instead.
+
+__attribute__((target("sse2")))
+static int evolve_row_sse2(const uint8_t *up, const uint8_t *mid, const uint8_t *down, uint8_t *out, int n){
+    const __m128i one = _mm_set1_epi8(1);
+    __m128i sum, m, alive, any, if_alive, if_dead, changed = _mm_setzero_si128();
+    __m128i counts[3][9];             // numbers of neighbours giving life to any cell, to alive ones, to dead ones
+    int lengths[3] = {0, 0, 0}, i, k;
+
+    for (k = 0; k <= 8; k++){
+        if (Rule.born >> k & Rule.survive >> k & 1) counts[0][lengths[0]++] = _mm_set1_epi8((char) k);
+        else if (Rule.survive >> k & 1)              counts[1][lengths[1]++] = _mm_set1_epi8((char) k);
+        else if (Rule.born >> k & 1)                 counts[2][lengths[2]++] = _mm_set1_epi8((char) k);
+    }
+
+    for (i = 0; i + 16 <= n; i += 16){
+        m   = _mm_loadu_si128((const __m128i *) (mid + i));
+        sum = _mm_add_epi8(_mm_add_epi8(_mm_loadu_si128((const __m128i *) (up + i - 1)),
+                                        _mm_loadu_si128((const __m128i *) (up + i))),
+                           _mm_loadu_si128((const __m128i *) (up + i + 1)));
+        sum = _mm_add_epi8(sum, _mm_add_epi8(_mm_loadu_si128((const __m128i *) (mid + i - 1)),
+                                             _mm_loadu_si128((const __m128i *) (mid + i + 1))));
+        sum = _mm_add_epi8(sum, _mm_add_epi8(_mm_add_epi8(_mm_loadu_si128((const __m128i *) (down + i - 1)),
+                                                          _mm_loadu_si128((const __m128i *) (down + i))),
+                                             _mm_loadu_si128((const __m128i *) (down + i + 1))));
+
+        any = if_alive = if_dead = _mm_setzero_si128();
+        for (k = 0; k < lengths[0]; k++) any      = _mm_or_si128(any,      _mm_cmpeq_epi8(sum, counts[0][k]));
+        for (k = 0; k < lengths[1]; k++) if_alive = _mm_or_si128(if_alive, _mm_cmpeq_epi8(sum, counts[1][k]));
+        for (k = 0; k < lengths[2]; k++) if_dead  = _mm_or_si128(if_dead,  _mm_cmpeq_epi8(sum, counts[2][k]));
+
+        // m is 0 or 1, so ~m & 1 tells the dead cells
+        alive   = _mm_or_si128(_mm_and_si128(any, one),
+                               _mm_or_si128(_mm_and_si128(if_alive, m), _mm_andnot_si128(m, _mm_and_si128(if_dead, one))));
+        changed = _mm_or_si128(changed, _mm_xor_si128(alive, m));
+        _mm_storeu_si128((__m128i *) (out + i), alive);
+    }
+
+    return (_mm_movemask_epi8(_mm_cmpeq_epi8(changed, _mm_setzero_si128())) != 0xFFFF)
+           | evolve_row_scalar(up + i, mid + i, down + i, out + i, n - i);
+}
+
+
+__attribute__((target("avx2")))
+static int evolve_row_avx2(const uint8_t *up, const uint8_t *mid, const uint8_t *down, uint8_t *out, int n){
+    const __m256i born    = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *) Rule.next[0]));
+    const __m256i survive = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *) Rule.next[1]));
+    __m256i sum, m, alive, changed = _mm256_setzero_si256();
+    int i, tail;
+
+    for (i = 0; i + 32 <= n; i += 32){
+        m   = _mm256_loadu_si256((const __m256i *) (mid + i));
+        sum = _mm256_add_epi8(_mm256_add_epi8(_mm256_loadu_si256((const __m256i *) (up + i - 1)),
+                                              _mm256_loadu_si256((const __m256i *) (up + i))),
+                              _mm256_loadu_si256((const __m256i *) (up + i + 1)));
+        sum = _mm256_add_epi8(sum, _mm256_add_epi8(_mm256_loadu_si256((const __m256i *) (mid + i - 1)),
+                                                   _mm256_loadu_si256((const __m256i *) (mid + i + 1))));
+        sum = _mm256_add_epi8(sum, _mm256_add_epi8(_mm256_add_epi8(_mm256_loadu_si256((const __m256i *) (down + i - 1)),
+                                                                   _mm256_loadu_si256((const __m256i *) (down + i))),
+                                                   _mm256_loadu_si256((const __m256i *) (down + i + 1))));
+
+        // m is 0 or 1, so ~m & born is born for the dead cells and 0 for the alive ones
+        alive   = _mm256_or_si256(_mm256_and_si256(_mm256_shuffle_epi8(survive, sum), m),
+                                  _mm256_andnot_si256(m, _mm256_shuffle_epi8(born, sum)));
+        changed = _mm256_or_si256(changed, _mm256_xor_si256(alive, m));
+        _mm256_storeu_si256((__m256i *) (out + i), alive);
+    }
+
+    tail = evolve_row_scalar(up + i, mid + i, down + i, out + i, n - i);
+    return (!_mm256_testz_si256(changed, changed)) | tail;
+}
+
+
+__attribute__((target("avx512f,avx512bw")))
+static int evolve_row_avx512(const uint8_t *up, const uint8_t *mid, const uint8_t *down, uint8_t *out, int n){
+    const __m512i born    = _mm512_broadcast_i32x4(_mm_loadu_si128((const __m128i *) Rule.next[0]));
+    const __m512i survive = _mm512_broadcast_i32x4(_mm_loadu_si128((const __m128i *) Rule.next[1]));
+    __m512i sum, m, alive;
+    __mmask64 is_alive, changed = 0;
+    int i;
+
+    for (i = 0; i + 64 <= n; i += 64){
+        m   = _mm512_loadu_si512((const void *) (mid + i));
+        sum = _mm512_add_epi8(_mm512_add_epi8(_mm512_loadu_si512((const void *) (up + i - 1)),
+                                              _mm512_loadu_si512((const void *) (up + i))),
+                              _mm512_loadu_si512((const void *) (up + i + 1)));
+        sum = _mm512_add_epi8(sum, _mm512_add_epi8(_mm512_loadu_si512((const void *) (mid + i - 1)),
+                                                   _mm512_loadu_si512((const void *) (mid + i + 1))));
+        sum = _mm512_add_epi8(sum, _mm512_add_epi8(_mm512_add_epi8(_mm512_loadu_si512((const void *) (down + i - 1)),
+                                                                   _mm512_loadu_si512((const void *) (down + i))),
+                                                   _mm512_loadu_si512((const void *) (down + i + 1))));
+
+        is_alive = _mm512_test_epi8_mask(m, m);
+        alive    = _mm512_mask_blend_epi8(is_alive, _mm512_shuffle_epi8(born, sum), _mm512_shuffle_epi8(survive, sum));
+        changed |= _mm512_cmpneq_epi8_mask(alive, m);
+        _mm512_storeu_si512((void *) (out + i), alive);
+    }
+
+    return (changed != 0) | evolve_row_scalar(up + i, mid + i, down + i, out + i, n - i);
+}
+
+#endif
+
+
+static rowKernel evolve_row = evolve_row_scalar;
+
+
+const char *selectSimdKernel(int isa){
+#ifdef SIMD_X86
+    __builtin_cpu_init();   // cpuid is only queried once, before any other thread exists
+
+    if (isa == ISA_AUTO){
+        if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")) isa = ISA_AVX512;
+        else if (__builtin_cpu_supports("avx2"))                                     isa = ISA_AVX2;
+        else if (__builtin_cpu_supports("sse2"))                                     isa = ISA_SSE2;
+        else                                                                          isa = ISA_SCALAR;
+    }
+
+    if (isa == ISA_AVX512){
+        if (!__builtin_cpu_supports("avx512f") || !__builtin_cpu_supports("avx512bw")) return NULL;
+        evolve_row = evolve_row_avx512;
+        return "avx512";
+    }
+    if (isa == ISA_AVX2){
+        if (!__builtin_cpu_supports("avx2")) return NULL;
+        evolve_row = evolve_row_avx2;
+        return "avx2";
+    }
+    if (isa == ISA_SSE2){
+        if (!__builtin_cpu_supports("sse2")) return NULL;
+        evolve_row = evolve_row_sse2;
+        return "sse2";
+    }
+#else
+    if (isa != ISA_AUTO && isa != ISA_SCALAR) return NULL;
+#endif
+
+    evolve_row = evolve_row_scalar;
+    return "scalar";
+}
+
+
+void allocateByteBoard(struct byteBoard *board, int rows, int cols, int depth){
+    size_t size;
+
+    board->rows  = rows;
+    board->cols  = cols;
+    board->depth = depth;
+    board->pitch = (cols + 2 * depth + SIMD_ALIGNMENT - 1) / SIMD_ALIGNMENT * SIMD_ALIGNMENT;
+
+    size = (size_t) (rows + 2 * depth) * board->pitch;
+    board->cells = allocateSharedBoard(size, &board->cells_window);      // aligned on at least SIMD_ALIGNMENT
+    board->next  = allocateSharedBoard(size, &board->next_window);
+    touchRows(board->cells, board->pitch, rows + 2 * depth);
+    touchRows(board->next,  board->pitch, rows + 2 * depth);
+}
+
+void freeByteBoard(struct byteBoard *board){
+    size_t size = (size_t) (board->rows + 2 * board->depth) * board->pitch;
+
+    freeSharedBoard(board->cells, size, &board->cells_window);
+    freeSharedBoard(board->next,  size, &board->next_window);
+}
+
+
+void setByteRegion(struct byteBoard *board, struct region region, const int *in){
+    uint8_t *dst;
+    int row, col;
+
+    for (row = region.row_from; row < region.row_to; row++){
+        dst = board->cells + (size_t) (row + board->depth) * board->pitch + board->depth;
+        for (col = region.col_from; col < region.col_to; col++) dst[col] = (uint8_t) *in++;
+    }
+}
+
+void getByteRegion(const struct byteBoard *board, struct region region, int *out){
+    const uint8_t *src;
+    int row, col;
+
+    for (row = region.row_from; row < region.row_to; row++){
+        src = board->cells + (size_t) (row + board->depth) * board->pitch + board->depth;
+        for (col = region.col_from; col < region.col_to; col++) *out++ = src[col];
+    }
+}
+
+
+// next state of cells [from, from+n) of the given row (padded coordinates)
+static int evolve_segment(struct byteBoard *board, int row, int from, int n){
+    const uint8_t *mid = board->cells + (size_t) row * board->pitch + from;
+
+    if (n <= 0) return 0;
+    return evolve_row(mid - board->pitch, mid, mid + board->pitch, board->next + (size_t) row * board->pitch + from, n);
+}
+
+
+int evolveByteBand(struct byteBoard *board, struct region region){
+    int row, block, end, flag = 0;
+    struct region band = threadBand(region);
+    double busy = phaseClock();
+
+    for (block = band.col_from; block < band.col_to; block += BLOCK_COLUMNS(1)){
+        end = (block + BLOCK_COLUMNS(1) < band.col_to) ? block + BLOCK_COLUMNS(1) : band.col_to;
+        for (row = band.row_from; row < band.row_to; row++) flag |= evolve_segment(board, row, block, end - block);
+    }
+    lapThread(busy);
+    return flag;
+}
+
+
+int evolveByteTile(struct byteBoard *board, struct region region){
+    int row, flag = 0;
+
+    for (row = region.row_from; row < region.row_to; row++){
+        flag |= evolve_segment(board, row, region.col_from, region.col_to - region.col_from);
+    }
+    return flag;
+}
+
+
+void swapByteBoard(struct byteBoard *board){
+    uint8_t *temp = board->cells;
+    MPI_Win window = board->cells_window;
+
+    board->cells        = board->next;
+    board->next         = temp;
+    board->cells_window = board->next_window;
+    board->next_window  = window;
+}
+
+
+uint64_t hashByteBoard(const struct byteBoard *board){
+    return hashPaddedBoard(board->cells, 1, board->rows, board->cols, board->pitch, board->depth);
+}
+
+
+// The simd kernel as an engine (see engine.h), with the exchange of each of its two buffers
+struct simdEngine{
+    struct byteBoard board;
+    struct halo halo[2];
+    int current;                      // halo of the buffer holding the current generation
+    struct rollingHash hash;
+    long long generations, cells;     // see engineStats
+};
+
+static void *simd_allocate(int rows, int cols, int depth){
+    struct simdEngine *engine = malloc(sizeof(struct simdEngine));
+    struct byteBoard *board = &engine->board;
+
+    allocateByteBoard(board, rows, cols, depth);
+    setupPaddedHalo(&engine->halo[0], board->cells, board->cells_window, MPI_UINT8_T, rows, cols, board->pitch, depth);
+    setupPaddedHalo(&engine->halo[1], board->next,  board->next_window,  MPI_UINT8_T, rows, cols, board->pitch, depth);
+    engine->current     = 0;
+    engine->generations = 0;
+    engine->cells       = 0;
+    forgetRollingHash(&engine->hash);
+    return engine;
+}
+
+static void simd_free(void *board){
+    struct simdEngine *engine = board;
+
+    freeHalo(&engine->halo[0]);
+    freeHalo(&engine->halo[1]);
+    freeByteBoard(&engine->board);
+    free(engine);
+}
+
+static void simd_put_region(void *board, struct region region, const int *in){
+    struct simdEngine *engine = board;
+
+    setByteRegion(&engine->board, region, in);
+    forgetRollingHash(&engine->hash);
+}
+
+static void simd_get_region(const void *board, struct region region, int *out){
+    getByteRegion(&((const struct simdEngine *) board)->board, region, out);
+}
+
+static void simd_start_halo(void *board){
+    struct simdEngine *engine = board;
+    startHalo(&engine->halo[engine->current]);
+}
+
+static void simd_progress_halo(void *board){
+    struct simdEngine *engine = board;
+    progressHalo(&engine->halo[engine->current]);
+}
+
+static void simd_finish_halo(void *board){
+    struct simdEngine *engine = board;
+    finishHalo(&engine->halo[engine->current]);
+}
+
+static int simd_step(void *board, struct region region){
+    struct simdEngine *engine = board;
+
+    struct byteBoard *cells = &engine->board;
+    int flag;
+
+    countCells(&engine->cells, region);
+    flag = evolveByteBand(cells, region);
+    if (rollingHashes()) {
+        addBandHash(&engine->hash, hashPaddedBand(cells->next, 1, cells->rows, cells->cols, cells->pitch, cells->depth,
+                                                  threadBand(region)));
+    }
+    return flag;
+}
+
+static void simd_swap(void *board){
+    struct simdEngine *engine = board;
+
+    swapByteBoard(&engine->board);
+    engine->current = 1 - engine->current;
+    engine->generations++;
+    swapRollingHash(&engine->hash);
+}
+
+static uint64_t simd_hash(void *board){
+    struct simdEngine *engine = board;
+
+    if (!engine->hash.known) setRollingHash(&engine->hash, hashByteBoard(&engine->board));
+    return engine->hash.current;
+}
+
+static void simd_stats(const void *board, struct engineStats *stats){
+    const struct simdEngine *engine = board;
+    const struct byteBoard *cells = &engine->board;
+
+    stats->generations += engine->generations;
+    stats->cells       += engine->cells;
+    stats->bytes        = 2 * (long long) (cells->rows + 2 * cells->depth) * cells->pitch;
+}
+
+const struct engine SimdEngine = {
+    "simd", simd_allocate, simd_put_region, simd_get_region, NULL, simd_start_halo, simd_progress_halo, simd_finish_halo,
+    simd_step, NULL, simd_swap, simd_hash, simd_stats, simd_free
+};
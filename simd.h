@@ -0,0 +1,38 @@
+#ifndef _SIMD_H_
+#define _SIMD_H_
+
+#include <stdint.h>
+
+#include "lib.h"
+
+#define SIMD_ALIGNMENT 64             // rows start on a cache line / widest vector boundary
+
+
+// A subboard stored with one byte (0 or 1) per cell, padded with depth ghost cells on each side:
+// the cell of row r, column c lives at cells[(r+depth) * pitch + (c+depth)].
+struct byteBoard{
+    int rows;
+    int cols;
+    int depth;                        // ghost cells on each side
+    int pitch;                        // bytes per row, ghost columns included, multiple of SIMD_ALIGNMENT
+    uint8_t *cells;                   // current generation, (rows+2*depth) * pitch bytes
+    uint8_t *next;                    // next generation is written here, then the two are swapped
+    MPI_Win cells_window, next_window;  // their windows with --shared-memory, MPI_WIN_NULL otherwise
+};
+
+
+const char *selectSimdKernel(int isa);                                   // pick the row kernel, returns its name or NULL if the cpu lacks it
+
+void allocateByteBoard(struct byteBoard *board, int rows, int cols, int depth);  // collective, see allocateSharedBoard
+void freeByteBoard(struct byteBoard *board);
+
+void setByteRegion(struct byteBoard *board, struct region region, const int *in);    // store 0/1 ints, row after row
+void getByteRegion(const struct byteBoard *board, struct region region, int *out);   // load them
+
+int evolveByteBand(struct byteBoard *board, struct region region);      // next state of the calling thread's band of a region (padded coordinates)
+int evolveByteTile(struct byteBoard *board, struct region region);      // next state of all the cells of a region
+void swapByteBoard(struct byteBoard *board);                             // make the next generation the current one
+uint64_t hashByteBoard(const struct byteBoard *board);                  // hash of the cells of the subboard
+
+
+#endif
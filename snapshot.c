@@ -0,0 +1,150 @@
+#include <stdlib.h>  /* for malloc/free */
+#include <string.h>
+
+#include "lib.h"
+#include "snapshot.h"
+
+
+static long long first_generation = 0;
+
+// the snapshot being written while the game goes on
+static struct{
+    int active;
+    MPI_File file;
+    MPI_Request request;
+    unsigned char *bytes;             // must stay untouched until the write completes
+} pending;
+
+
+// Preview cells of factor x factor board cells covering the cells [start, start+size) of one dimension:
+// returns their number, the first one in *first
+static int preview_span(int start, int size, int factor, int *first){
+    *first = start / factor;
+    return (start + size - 1) / factor - *first + 1;
+}
+
+// Every process counts the alive cells of the preview cells its block touches, the master adds them up (a preview
+// cell may straddle several blocks) and prints one character per preview cell, darker where more cells are alive.
+static void show_preview(struct subboard block, long long generation){
+    static const char shades[] = ".:+oO";
+    int factor = Params.preview_factor;
+    int preview_rows = (Params.Rows + factor - 1) / factor, preview_cols = (Params.Cols + factor - 1) / factor;
+    int first_row, first_col, rows, cols, row, col, myid, numprocs, i, r, c, total;
+    int coords[2], *sizes = NULL, *displs = NULL, *counts, *all = NULL, *preview, area, shade;
+    int *cells = malloc(sizeof(int) * Grid.cols);
+
+    MPI_Comm_rank(Grid.comm, &myid);
+    MPI_Comm_size(Grid.comm, &numprocs);
+
+    rows   = preview_span(Grid.row0, Grid.rows, factor, &first_row);
+    cols   = preview_span(Grid.col0, Grid.cols, factor, &first_col);
+    counts = calloc((size_t) rows * cols, sizeof(int));
+    for (row = 0; row < Grid.rows; row++){
+        getSubboardRow(block, row, cells);
+        for (col = 0; col < Grid.cols; col++){
+            counts[((Grid.row0 + row) / factor - first_row) * cols + (Grid.col0 + col) / factor - first_col] += cells[col];
+        }
+    }
+    free(cells);
+
+    if (I_AM_MASTER(myid)){
+        sizes  = malloc(sizeof(int) * numprocs);
+        displs = malloc(sizeof(int) * numprocs);
+        for (i = 0, total = 0; i < numprocs; i++){
+            MPI_Cart_coords(Grid.comm, i, 2, coords);
+            sizes[i]  = preview_span(blockRow0(coords[0]), blockRows(coords[0]), factor, &r)
+                      * preview_span(blockCol0(coords[1]), blockCols(coords[1]), factor, &c);
+            displs[i] = total;
+            total    += sizes[i];
+        }
+        all = malloc(sizeof(int) * total);
+    }
+    MPI_Gatherv(counts, rows * cols, MPI_INT, all, sizes, displs, MPI_INT, MASTER_PROC_ID, Grid.comm);
+
+    if (I_AM_MASTER(myid)){
+        preview = calloc((size_t) preview_rows * preview_cols, sizeof(int));
+        for (i = 0; i < numprocs; i++){
+            MPI_Cart_coords(Grid.comm, i, 2, coords);
+            rows = preview_span(blockRow0(coords[0]), blockRows(coords[0]), factor, &first_row);
+            cols = preview_span(blockCol0(coords[1]), blockCols(coords[1]), factor, &first_col);
+            for (r = 0; r < rows; r++){
+                for (c = 0; c < cols; c++) preview[(first_row + r) * preview_cols + first_col + c] += all[displs[i] + r * cols + c];
+            }
+        }
+
+        printf("\nGeneration %lld, %d x %d cells per character:\n", generation, factor, factor);
+        for (r = 0; r < preview_rows; r++){
+            for (c = 0; c < preview_cols; c++){
+                // the last row and column of preview cells may be cut by the edge of the board
+                area  = ((r + 1) * factor > Params.Rows ? Params.Rows - r * factor : factor)
+                      * ((c + 1) * factor > Params.Cols ? Params.Cols - c * factor : factor);
+                shade = preview[r * preview_cols + c] == 0 ? 0 : 1 + (preview[r * preview_cols + c] * 4 - 1) / area;
+                putchar(shades[shade]);
+            }
+            putchar('\n');
+        }
+        fflush(stdout);
+
+        free(preview);
+        free(sizes);
+        free(displs);
+        free(all);
+    }
+    free(counts);
+}
+
+
+void setupSnapshots(long long generation){
+    first_generation = generation;
+    pending.active   = 0;
+}
+
+int snapshotDue(int numIterations){
+    return Params.snapshot_every > 0 && numIterations % Params.snapshot_every == 0;
+}
+
+
+void writeSnapshot(struct subboard block, int numIterations){
+    long long generation = first_generation + numIterations;
+    int byte0, width, length, myid;
+    int sizes[2], subsizes[2], starts[2];
+    char header[64], *path;
+    MPI_Datatype view;
+
+    finishSnapshots();
+    if (Params.preview_factor > 0) show_preview(block, generation);
+
+    pending.bytes = packBlockBytes(block, 1, &byte0, &width);
+    length = snprintf(header, sizeof(header), "P4\n%d %d\n", Params.Cols, Params.Rows);
+    path   = malloc(strlen(Params.snapshot_file) + 32);
+    sprintf(path, "%s%06lld.pbm", Params.snapshot_file, generation);
+
+    MPI_Comm_rank(Grid.comm, &myid);
+    if (MPI_File_open(Grid.comm, path, MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &pending.file) != MPI_SUCCESS){
+        collectiveError("Could not write the snapshot `%s'.\n", path);
+    }
+    MPI_File_set_size(pending.file, (MPI_Offset) length + (MPI_Offset) Params.Rows * ((Params.Cols + 7) / 8));
+    if (I_AM_MASTER(myid)) MPI_File_write_at(pending.file, 0, header, length, MPI_BYTE, MPI_STATUS_IGNORE);
+
+    sizes[0]    = Params.Rows;  sizes[1]    = (Params.Cols + 7) / 8;
+    subsizes[0] = Grid.rows;    subsizes[1] = width;
+    starts[0]   = Grid.row0;    starts[1]   = byte0;
+    MPI_Type_create_subarray(2, sizes, subsizes, starts, MPI_ORDER_C, MPI_BYTE, &view);
+    MPI_Type_commit(&view);
+    MPI_File_set_view(pending.file, length, MPI_BYTE, view, "native", MPI_INFO_NULL);
+    MPI_Type_free(&view);
+
+    MPI_File_iwrite_at_all(pending.file, 0, pending.bytes, Grid.rows * width, MPI_BYTE, &pending.request);
+    pending.active = 1;
+    free(path);
+}
+
+
+void finishSnapshots(void){
+    if (!pending.active) return;
+
+    MPI_Wait(&pending.request, MPI_STATUS_IGNORE);
+    MPI_File_close(&pending.file);
+    free(pending.bytes);
+    pending.active = 0;
+}
@@ -0,0 +1,20 @@
+#ifndef _SNAPSHOT_H_
+#define _SNAPSHOT_H_
+
+#include "lib.h"
+
+
+// A snapshot is a binary PBM (P4) image of the whole board, one file per generation named after --snapshot-file
+// and the generation, written by all the processes at once. Its rows are packed one bit per cell, the first column
+// in the high bit, and an alive cell is black.
+
+void setupSnapshots(long long generation);                   // generation of the board the game starts from
+int snapshotDue(int numIterations);
+
+// Collective. Start writing the board of numIterations generations after the start, and show its preview. The
+// write goes on in the background while the game is played, until the next snapshot or finishSnapshots.
+void writeSnapshot(struct subboard block, int numIterations);
+void finishSnapshots(void);                                  // collective, wait for the last write
+
+
+#endif
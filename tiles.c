@@ -0,0 +1,302 @@
+#include <stdlib.h>  /* for malloc/free */
+#include <string.h>
+
+#include "lib.h"
+#include "simd.h"
+#include "tiles.h"
+#include "engine.h"
+#include "timing.h"
+
+
+static uint8_t *byte_cell(uint8_t *cells, const struct byteBoard *board, int row, int col){
+    return cells + (size_t) row * board->pitch + col;
+}
+
+// cells of tile (ti, tj) in padded coordinates, the last row/column of tiles may be cut short
+static struct region tile_region(const struct byteBoard *board, int ti, int tj){
+    struct region region;
+
+    region.row_from = 1 + ti * TILE_ROWS;
+    region.row_to   = 1 + ((ti + 1) * TILE_ROWS < board->rows ? (ti + 1) * TILE_ROWS : board->rows);
+    region.col_from = 1 + tj * TILE_COLS;
+    region.col_to   = 1 + ((tj + 1) * TILE_COLS < board->cols ? (tj + 1) * TILE_COLS : board->cols);
+    return region;
+}
+
+static int is_edge_tile(const struct tileMap *map, int ti, int tj){
+    return ti == 0 || ti == map->tile_rows - 1 || tj == 0 || tj == map->tile_cols - 1;
+}
+
+static void activate_block(struct tileMap *map, int ti_from, int ti_to, int tj_from, int tj_to){
+    int ti, tj;
+
+    for (ti = ti_from; ti <= ti_to; ti++){
+        for (tj = tj_from; tj <= tj_to; tj++) map->active[ti * map->tile_cols + tj] = 1;
+    }
+}
+
+
+void allocateTileMap(struct tileMap *map, struct byteBoard *board){
+    int tiles;
+
+    map->tile_rows = (board->rows + TILE_ROWS - 1) / TILE_ROWS;
+    map->tile_cols = (board->cols + TILE_COLS - 1) / TILE_COLS;
+    tiles = map->tile_rows * map->tile_cols;
+
+    map->changed = malloc(tiles);
+    map->active  = malloc(tiles);
+    map->list    = malloc(sizeof(int) * tiles);
+    map->hashes  = calloc(tiles, sizeof(uint64_t));
+    map->hash    = 0;
+    memset(map->changed, 1, tiles);     // nothing is known about the first generation
+    memset(map->active,  0, tiles);
+
+    map->fresh    = 1;
+    map->computed = 0;
+    map->total    = 0;
+    map->cells    = 0;
+
+    memcpy(board->next, board->cells, (size_t) (board->rows + 2) * board->pitch);
+}
+
+void freeTileMap(struct tileMap *map){
+    free(map->changed);
+    free(map->active);
+    free(map->list);
+    free(map->hashes);
+}
+
+
+// The next buffer still holds the previous generation, so an edge changed if the two buffers differ there
+void collectChangedEdges(struct tileMap *map, const struct byteBoard *board){
+    int i, row, rows = board->rows, cols = board->cols;
+    const uint8_t *now  = board->cells;
+    const uint8_t *then = board->next;
+
+    if (map->fresh){
+        for (i = 0; i < 8; i++) map->edges[i] = 1;
+        map->fresh = 0;
+        return;
+    }
+
+    map->edges[0] = memcmp(now + (size_t) 1 * board->pitch + 1, then + (size_t) 1 * board->pitch + 1, cols) != 0;
+    map->edges[1] = memcmp(now + (size_t) rows * board->pitch + 1, then + (size_t) rows * board->pitch + 1, cols) != 0;
+    map->edges[2] = map->edges[3] = 0;
+    for (row = 1; row <= rows; row++){
+        map->edges[2] |= now[(size_t) row * board->pitch + 1]    != then[(size_t) row * board->pitch + 1];
+        map->edges[3] |= now[(size_t) row * board->pitch + cols] != then[(size_t) row * board->pitch + cols];
+    }
+    map->edges[4] = now[(size_t) 1 * board->pitch + 1]       != then[(size_t) 1 * board->pitch + 1];
+    map->edges[5] = now[(size_t) 1 * board->pitch + cols]    != then[(size_t) 1 * board->pitch + cols];
+    map->edges[6] = now[(size_t) rows * board->pitch + 1]    != then[(size_t) rows * board->pitch + 1];
+    map->edges[7] = now[(size_t) rows * board->pitch + cols] != then[(size_t) rows * board->pitch + cols];
+}
+
+
+void markActiveTiles(struct tileMap *map){
+    int ti, tj, i, j, active;
+
+    for (ti = 0; ti < map->tile_rows; ti++){
+        for (tj = 0; tj < map->tile_cols; tj++){
+            active = 0;
+            for (i = ti - 1; i <= ti + 1; i++){
+                for (j = tj - 1; j <= tj + 1; j++){
+                    if (i >= 0 && i < map->tile_rows && j >= 0 && j < map->tile_cols) active |= map->changed[i * map->tile_cols + j];
+                }
+            }
+            map->active[ti * map->tile_cols + tj] = (uint8_t) active;
+        }
+    }
+}
+
+
+// A ghost edge that did not come did not change since the last exchange, which left it in the other buffer. One that did come wakes up the tiles along it.
+void storeSparseHalo(struct tileMap *map, struct byteBoard *board, const int received[8]){
+    int row, rows = board->rows, cols = board->cols;
+    int last_ti = map->tile_rows - 1, last_tj = map->tile_cols - 1;
+
+    if (received[0]) activate_block(map, 0, 0, 0, last_tj);
+    else memcpy(byte_cell(board->cells, board, 0, 1), byte_cell(board->next, board, 0, 1), cols);
+
+    if (received[1]) activate_block(map, last_ti, last_ti, 0, last_tj);
+    else memcpy(byte_cell(board->cells, board, rows + 1, 1), byte_cell(board->next, board, rows + 1, 1), cols);
+
+    if (received[2]) activate_block(map, 0, last_ti, 0, 0);
+    else for (row = 1; row <= rows; row++) *byte_cell(board->cells, board, row, 0) = *byte_cell(board->next, board, row, 0);
+
+    if (received[3]) activate_block(map, 0, last_ti, last_tj, last_tj);
+    else for (row = 1; row <= rows; row++) *byte_cell(board->cells, board, row, cols + 1) = *byte_cell(board->next, board, row, cols + 1);
+
+    if (received[4]) activate_block(map, 0, 0, 0, 0);
+    else *byte_cell(board->cells, board, 0, 0) = *byte_cell(board->next, board, 0, 0);
+
+    if (received[5]) activate_block(map, 0, 0, last_tj, last_tj);
+    else *byte_cell(board->cells, board, 0, cols + 1) = *byte_cell(board->next, board, 0, cols + 1);
+
+    if (received[6]) activate_block(map, last_ti, last_ti, 0, 0);
+    else *byte_cell(board->cells, board, rows + 1, 0) = *byte_cell(board->next, board, rows + 1, 0);
+
+    if (received[7]) activate_block(map, last_ti, last_ti, last_tj, last_tj);
+    else *byte_cell(board->cells, board, rows + 1, cols + 1) = *byte_cell(board->next, board, rows + 1, cols + 1);
+}
+
+
+// The master lists the active tiles, then the threads of the team take them one at a time
+int evolveActiveTiles(struct tileMap *map, struct byteBoard *board, int edge){
+    int ti, tj, t, i, flag = 0;
+    struct region region;
+    double busy;
+
+#pragma omp master
+    {
+        map->listed = 0;
+        for (ti = 0; ti < map->tile_rows; ti++){
+            for (tj = 0; tj < map->tile_cols; tj++){
+                if (is_edge_tile(map, ti, tj) != edge) continue;
+
+                t = ti * map->tile_cols + tj;
+                map->total++;
+                if (map->active[t]){
+                    region = tile_region(board, ti, tj);
+                    map->cells += (long long) (region.row_to - region.row_from) * (region.col_to - region.col_from);
+                    map->list[map->listed++] = t;
+                }else{
+                    map->changed[t] = 0;
+                }
+            }
+        }
+        map->computed += map->listed;
+    }
+#pragma omp barrier
+
+    busy = phaseClock();
+#pragma omp for schedule(dynamic) nowait
+    for (i = 0; i < map->listed; i++){
+        t = map->list[i];
+        map->changed[t] = (uint8_t) evolveByteTile(board, tile_region(board, t / map->tile_cols, t % map->tile_cols));
+        flag |= map->changed[t];
+    }
+    lapThread(busy);
+    return flag;
+}
+
+
+// Only the tiles that changed in the last generation have a new hash
+uint64_t hashTiledBoard(struct tileMap *map, const struct byteBoard *board){
+    int t, row, tiles = map->tile_rows * map->tile_cols;
+    uint64_t hash;
+    struct region region;
+
+    for (t = 0; t < tiles; t++){
+        if (!map->changed[t]) continue;
+
+        region = tile_region(board, t / map->tile_cols, t % map->tile_cols);
+        hash = mixHash((uint64_t) t);
+        for (row = region.row_from; row < region.row_to; row++){
+            hash = hashCells(hash, board->cells + (size_t) row * board->pitch + region.col_from, region.col_to - region.col_from);
+        }
+
+        map->hash     ^= map->hashes[t] ^ hash;
+        map->hashes[t] = hash;
+    }
+    return map->hash;
+}
+
+
+// The tiled kernel as an engine (see engine.h). Its halo is one cell deep, and the buffers alternate every
+// generation, so the messages are posted again each time.
+struct tiledEngine{
+    struct byteBoard board;
+    struct tileMap map;
+    struct halo halo;
+    int received[8];                  // ghost edges that came in the last exchange
+    long long generations;            // see engineStats
+};
+
+static void *tiled_allocate(int rows, int cols, int depth){
+    struct tiledEngine *engine = malloc(sizeof(struct tiledEngine));
+
+    allocateByteBoard(&engine->board, rows, cols, depth);
+    setupHaloTypes(&engine->halo, MPI_UINT8_T, rows, cols, engine->board.pitch, depth);
+    engine->generations = 0;
+    return engine;
+}
+
+static void tiled_init(void *board){
+    struct tiledEngine *engine = board;
+    allocateTileMap(&engine->map, &engine->board);
+}
+
+static void tiled_free(void *board){
+    struct tiledEngine *engine = board;
+
+    freeHalo(&engine->halo);
+    freeTileMap(&engine->map);
+    freeByteBoard(&engine->board);
+    free(engine);
+}
+
+static void tiled_put_region(void *board, struct region region, const int *in){
+    setByteRegion(&((struct tiledEngine *) board)->board, region, in);
+}
+
+static void tiled_get_region(const void *board, struct region region, int *out){
+    getByteRegion(&((const struct tiledEngine *) board)->board, region, out);
+}
+
+// only the edges that changed are sent, the neighbours keep their copy of the others
+static void tiled_start_halo(void *board){
+    struct tiledEngine *engine = board;
+    struct byteBoard *cells = &engine->board;
+
+    collectChangedEdges(&engine->map, cells);
+    startSparseHalo(&engine->halo, cells->cells, MPI_UINT8_T, cells->rows, cells->cols, cells->pitch, engine->map.edges);
+    markActiveTiles(&engine->map);
+}
+
+static void tiled_finish_halo(void *board){
+    struct tiledEngine *engine = board;
+    struct byteBoard *cells = &engine->board;
+
+    finishSparseHalo(&engine->halo, cells->cells, MPI_UINT8_T, cells->rows, cells->cols, cells->pitch, engine->received);
+    storeSparseHalo(&engine->map, &engine->board, engine->received);
+}
+
+// the tiles do not follow the regions: the inner ones are computed first, then the ones along the edges
+static int tiled_step(void *board, struct region region){
+    struct tiledEngine *engine = board;
+    return evolveActiveTiles(&engine->map, &engine->board, 0);
+}
+
+static int tiled_frame(void *board, struct region outer, struct region inner){
+    struct tiledEngine *engine = board;
+    return evolveActiveTiles(&engine->map, &engine->board, 1);
+}
+
+static void tiled_swap(void *board){
+    struct tiledEngine *engine = board;
+
+    swapByteBoard(&engine->board);
+    engine->generations++;
+}
+
+static uint64_t tiled_hash(void *board){
+    struct tiledEngine *engine = board;
+    return hashTiledBoard(&engine->map, &engine->board);
+}
+
+static void tiled_stats(const void *board, struct engineStats *stats){
+    const struct tiledEngine *engine = board;
+    const struct byteBoard *cells = &engine->board;
+
+    stats->generations    += engine->generations;
+    stats->cells          += engine->map.cells;
+    stats->tiles          += engine->map.total;
+    stats->computed_tiles += engine->map.computed;
+    stats->bytes           = 2 * (long long) (cells->rows + 2) * cells->pitch;
+}
+
+const struct engine TiledEngine = {
+    "tiled", tiled_allocate, tiled_put_region, tiled_get_region, tiled_init, tiled_start_halo, NULL, tiled_finish_halo,
+    tiled_step, tiled_frame, tiled_swap, tiled_hash, tiled_stats, tiled_free
+};
@@ -0,0 +1,44 @@
+#ifndef _TILES_H_
+#define _TILES_H_
+
+#include <stdint.h>
+
+#include "lib.h"
+#include "simd.h"
+
+#define TILE_ROWS 32
+#define TILE_COLS 256               // long enough rows for the vector kernels to pay off
+
+
+// Activity tracking of a byte subboard (one ghost cell deep) split into TILE_ROWS x TILE_COLS tiles.
+// A tile is only computed when it or one of its neighbours changed in the last generation; every other tile
+// keeps its cells, which both buffers already hold since they match for two generations in a row.
+struct tileMap{
+    int tile_rows, tile_cols;         // tiles per column / row of the subboard
+    uint8_t *changed;                 // tiles that changed in the last generation
+    uint8_t *active;                  // tiles to compute in this generation
+    int *list;                        // indices of the active tiles, rebuilt for every pass
+    int listed;                       // tiles in the list
+    int edges[8];                     // edges of the subboard that changed since the last exchange, in halo request order
+    int fresh;                        // nothing was exchanged yet, every edge has to go out
+    long long computed, total;        // tiles computed / visited over the whole run
+    long long cells;                  // cells of the tiles computed
+    uint64_t *hashes;                 // hash of every tile, only refreshed for the tiles that changed
+    uint64_t hash;                    // of the whole subboard, the XOR of the tile hashes
+};
+
+
+// the current generation must already be in the board, it is copied into the other buffer as well
+void allocateTileMap(struct tileMap *map, struct byteBoard *board);
+void freeTileMap(struct tileMap *map);
+
+void collectChangedEdges(struct tileMap *map, const struct byteBoard *board);    // fill edges[] before an exchange
+void markActiveTiles(struct tileMap *map);                                     // from the tiles changed in the last generation
+void storeSparseHalo(struct tileMap *map, struct byteBoard *board, const int received[8]);   // keep the ghost edges not resent
+
+// the active inner (edge = 0) or edge (1) tiles, shared out over the team of the calling threads
+int evolveActiveTiles(struct tileMap *map, struct byteBoard *board, int edge);
+uint64_t hashTiledBoard(struct tileMap *map, const struct byteBoard *board);     // has to be called every generation
+
+
+#endif
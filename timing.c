@@ -0,0 +1,202 @@
+#include <stdlib.h>  /* for malloc/free */
+#include <string.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "lib.h"
+#include "timing.h"
+#include "engine.h"
+
+
+double PhaseTime[PHASES];
+struct threadTimer ThreadTime[TIMED_THREADS];
+#if PHASE_TIMERS
+static double compute_time;           // the inner and border phases, resetPhases leaves it for the load balancing
+#endif
+
+static const char *phase_names[PHASES] = {"inner", "halo", "border", "reduce", "other"};
+
+// phases of this process for --trace, in seconds since the common origin
+struct traceEvent{
+    int phase;
+    double start, length;
+};
+
+static struct{
+    struct traceEvent *events;        // NULL when not tracing
+    int count;
+    double origin;
+} trace;
+
+
+void setupTimers(void){
+    trace.count  = 0;
+    trace.events = (Params.trace_file != NULL) ? malloc(sizeof(struct traceEvent) * TRACE_EVENTS) : NULL;
+
+    MPI_Barrier(MPI_COMM_WORLD);
+    trace.origin = phaseClock();
+    resetPhases();
+}
+
+void resetPhases(void){
+    memset(PhaseTime, 0, sizeof(PhaseTime));
+    memset(ThreadTime, 0, sizeof(ThreadTime));
+}
+
+
+#if PHASE_TIMERS
+void lapPhase(int phase, double *since){
+    double now = phaseClock();
+
+    PhaseTime[phase] += now - *since;
+    if (phase == PHASE_INNER || phase == PHASE_BORDER) compute_time += now - *since;
+    if (trace.events != NULL && trace.count < TRACE_EVENTS){
+        trace.events[trace.count].phase  = phase;
+        trace.events[trace.count].start  = *since - trace.origin;
+        trace.events[trace.count].length = now - *since;
+        trace.count++;
+    }
+    *since = now;
+}
+
+double computeSeconds(void){
+    return compute_time;
+}
+
+void lapThread(double since){
+    int thread = 0;
+
+#ifdef _OPENMP
+    thread = omp_get_thread_num();
+#endif
+    if (thread < TIMED_THREADS) ThreadTime[thread].busy += phaseClock() - since;
+}
+#endif
+
+
+// The processes write their own part of the trace one after the other in the file: the master starts it, the last
+// one closes it, and every process names itself with a metadata event before its phases.
+static void write_trace(const char *path){
+    int myid, numprocs, i;
+    size_t size = 256 + (size_t) trace.count * 128, length = 0;
+    char *text = malloc(size);
+    long long offset, bytes;
+    MPI_File file;
+
+    MPI_Comm_rank(Grid.comm, &myid);
+    MPI_Comm_size(Grid.comm, &numprocs);
+
+    if (I_AM_MASTER(myid)) length += sprintf(text + length, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+    length += sprintf(text + length, "%s{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": %d, \"tid\": 0, \"args\": {\"name\": \"rank %d (%d, %d)\"}}",
+                      I_AM_MASTER(myid) ? "" : ",\n", myid, myid, Grid.coords[0], Grid.coords[1]);
+    for (i = 0; i < trace.count; i++){
+        length += sprintf(text + length, ",\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": %d, \"tid\": 0, \"ts\": %.3f, \"dur\": %.3f}",
+                          phase_names[trace.events[i].phase], myid, 1e6 * trace.events[i].start, 1e6 * trace.events[i].length);
+    }
+    if (myid == numprocs - 1) length += sprintf(text + length, "\n]}\n");
+
+    bytes  = (long long) length;
+    offset = 0;
+    MPI_Exscan(&bytes, &offset, 1, MPI_LONG_LONG, MPI_SUM, Grid.comm);
+    if (I_AM_MASTER(myid)) offset = 0;
+
+    if (MPI_File_open(Grid.comm, (char *) path, MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &file) != MPI_SUCCESS){
+        if (I_AM_MASTER(myid)) fprintf(stderr, "Could not write the trace `%s'.\n", path);
+        free(text);
+        return;
+    }
+    MPI_File_set_size(file, 0);
+    MPI_File_write_at_all(file, offset, text, (int) length, MPI_BYTE, MPI_STATUS_IGNORE);
+    MPI_File_close(&file);
+    free(text);
+}
+
+
+void reportTimers(void){
+    double min[PHASES], max[PHASES], sum[PHASES];
+    double busy[3] = {1e300, 0, 0}, busy_min, busy_max, busy_sum;
+    int myid, numprocs, threads = 1, all_threads, i;
+
+    MPI_Comm_rank(Grid.comm, &myid);
+    MPI_Comm_size(Grid.comm, &numprocs);
+
+#ifdef _OPENMP
+    threads = omp_get_max_threads();
+#endif
+    if (threads > TIMED_THREADS) threads = TIMED_THREADS;
+    for (i = 0; i < threads; i++){
+        if (ThreadTime[i].busy < busy[0]) busy[0] = ThreadTime[i].busy;
+        if (ThreadTime[i].busy > busy[1]) busy[1] = ThreadTime[i].busy;
+        busy[2] += ThreadTime[i].busy;
+    }
+
+    MPI_Reduce(PhaseTime, min, PHASES, MPI_DOUBLE, MPI_MIN, MASTER_PROC_ID, Grid.comm);
+    MPI_Reduce(PhaseTime, max, PHASES, MPI_DOUBLE, MPI_MAX, MASTER_PROC_ID, Grid.comm);
+    MPI_Reduce(PhaseTime, sum, PHASES, MPI_DOUBLE, MPI_SUM, MASTER_PROC_ID, Grid.comm);
+    MPI_Reduce(&busy[0], &busy_min, 1, MPI_DOUBLE, MPI_MIN, MASTER_PROC_ID, Grid.comm);
+    MPI_Reduce(&busy[1], &busy_max, 1, MPI_DOUBLE, MPI_MAX, MASTER_PROC_ID, Grid.comm);
+    MPI_Reduce(&busy[2], &busy_sum, 1, MPI_DOUBLE, MPI_SUM, MASTER_PROC_ID, Grid.comm);
+    MPI_Reduce(&threads, &all_threads, 1, MPI_INT, MPI_SUM, MASTER_PROC_ID, Grid.comm);
+
+    if (PHASE_TIMERS && I_AM_MASTER(myid)){
+        printf("Phase     min (sec)    mean (sec)   max (sec)\n");
+        for (i = 0; i < PHASES; i++) printf("%-8s  %-11f  %-11f  %f\n", phase_names[i], min[i], sum[i] / numprocs, max[i]);
+        printf("Threads busy in the parallel loops: %f sec (min), %f sec (mean), %f sec (max) over %d threads\n",
+               busy_min, busy_sum / all_threads, busy_max, all_threads);
+    }
+
+    if (trace.events != NULL){
+        write_trace(Params.trace_file);
+        free(trace.events);
+        trace.events = NULL;
+    }
+}
+
+
+void writeReport(const char *path, int generations, double seconds){
+    double max[PHASES], mean[PHASES], cells_per_second;
+    int myid, numprocs, threads = 1, json, i;
+    size_t length = strlen(path);
+    FILE *file;
+
+    MPI_Comm_rank(Grid.comm, &myid);
+    MPI_Comm_size(Grid.comm, &numprocs);
+    MPI_Reduce(PhaseTime, max,  PHASES, MPI_DOUBLE, MPI_MAX, MASTER_PROC_ID, Grid.comm);
+    MPI_Reduce(PhaseTime, mean, PHASES, MPI_DOUBLE, MPI_SUM, MASTER_PROC_ID, Grid.comm);
+    if (!I_AM_MASTER(myid)) return;
+
+#ifdef _OPENMP
+    threads = omp_get_max_threads();
+#endif
+    json = length > 5 && strcmp(path + length - 5, ".json") == 0;
+    cells_per_second = seconds > 0 ? (double) Params.Rows * Params.Cols * generations / seconds : 0;
+
+    file = fopen(path, "a");
+    if (file == NULL){
+        fprintf(stderr, "Could not write the report `%s'.\n", path);
+        return;
+    }
+
+    if (json){
+        fprintf(file, "{\"kernel\": \"%s\", \"rows\": %d, \"cols\": %d, \"procs\": %d, \"grid\": \"%dx%d\", \"threads\": %d, "
+                      "\"halo_depth\": %d, \"generations\": %d, \"seconds\": %.6f, \"cells_per_second\": %.6e",
+                kernelEngine(Params.kernel)->name, Params.Rows, Params.Cols, numprocs, Grid.dims[0], Grid.dims[1], threads,
+                Params.halo_depth, generations, seconds, cells_per_second);
+        for (i = 0; i < PHASES; i++) fprintf(file, ", \"%s_max\": %.6f, \"%s_mean\": %.6f", phase_names[i], max[i], phase_names[i], mean[i] / numprocs);
+        fprintf(file, "}\n");
+    }else{
+        fseek(file, 0, SEEK_END);
+        if (ftell(file) == 0){
+            fprintf(file, "kernel,rows,cols,procs,grid,threads,halo_depth,generations,seconds,cells_per_second");
+            for (i = 0; i < PHASES; i++) fprintf(file, ",%s_max,%s_mean", phase_names[i], phase_names[i]);
+            fprintf(file, "\n");
+        }
+        fprintf(file, "%s,%d,%d,%d,%dx%d,%d,%d,%d,%.6f,%.6e", kernelEngine(Params.kernel)->name, Params.Rows, Params.Cols,
+                numprocs, Grid.dims[0], Grid.dims[1], threads, Params.halo_depth, generations, seconds, cells_per_second);
+        for (i = 0; i < PHASES; i++) fprintf(file, ",%.6f,%.6f", max[i], mean[i] / numprocs);
+        fprintf(file, "\n");
+    }
+    fclose(file);
+}
@@ -0,0 +1,65 @@
+#ifndef _TIMING_H_
+#define _TIMING_H_
+
+#include <time.h>
+
+#include "lib.h"
+
+// Build with -DPHASE_TIMERS=0 (make TIMERS=0) to compile the timers out of the game loops
+#ifndef PHASE_TIMERS
+#define PHASE_TIMERS 1
+#endif
+
+// Phases of a generation
+#define PHASE_INNER 0                 // cells that need no ghost cells, and whole steps between two exchanges
+#define PHASE_HALO 1                  // packing the edges and waiting for the halo exchange
+#define PHASE_BORDER 2                // cells that needed the ghost cells
+#define PHASE_REDUCE 3                // agreeing whether to go on
+#define PHASE_OTHER 4                 // printing, hashing, checkpoints and images
+#define PHASES 5
+
+#define TIMED_THREADS 256             // threads with an accumulator, the others are not timed
+#define TRACE_EVENTS (1 << 20)        // phases kept per process for --trace, the later ones are dropped
+
+extern double PhaseTime[PHASES];      // seconds spent in each phase by this process
+
+// Seconds a thread spent computing its share of the parallel loops, one cache line each
+struct threadTimer{
+    double busy;
+    char padding[64 - sizeof(double)];
+};
+
+extern struct threadTimer ThreadTime[TIMED_THREADS];
+
+
+#if PHASE_TIMERS
+static inline double phaseClock(void){
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double) now.tv_sec + 1e-9 * (double) now.tv_nsec;
+}
+
+void lapPhase(int phase, double *since);                     // charge the time since *since to phase, and restart it
+void lapThread(double since);                                // charge the time since to the calling thread
+double computeSeconds(void);                                 // inner and border phases since the start, never reset
+#else
+static inline double phaseClock(void){ return 0; }
+#define lapPhase(phase, since) ((void) (since))
+#define lapThread(since) ((void) (since))
+static inline double computeSeconds(void){ return 0; }
+#endif
+
+void setupTimers(void);                                      // collective, the common origin of the trace
+void resetPhases(void);
+
+// Collective. The master prints the min, mean and max over the processes of every phase and over all threads of
+// their busy time, and with --trace the phases of every process are written as a Chrome trace.
+void reportTimers(void);
+
+// Collective. Append the measures of a run of the given generations to --report: one CSV row (with a header when
+// the file is new), or one JSON object per line when the name ends in .json.
+void writeReport(const char *path, int generations, double seconds);
+
+
+#endif